@@ -0,0 +1,371 @@
+// Benchmark for CanvasHelper layout and export hot paths. Runs in batch mode without display.
+// Usage: canvasHelperBench [csv|json] [repetitions]
+//        canvasHelperBench verify - compares batch Round::valueErrors() against scalar Round::valueError()
+//                                  and checks Layout::computePad() results without any canvas
+// Results are printed to stdout - one record per benchmark. Exported files are written to the temp directory.
+
+#include "CanvasHelper.h"
+
+#include <TApplication.h>
+#include <TROOT.h>
+#include <TSystem.h>
+#include <TCanvas.h>
+#include <TStyle.h>
+#include <TH1.h>
+#include <TF1.h>
+#include <TLegend.h>
+#include <TPaveText.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <random>
+#include <cmath>
+#include <cstring>
+
+// Expose protected measurement helpers to the benchmark
+class BenchCanvasHelper: public CanvasHelper {
+  public:
+    using CanvasHelper::getLegendWidthPx;
+};
+
+struct BenchResult {
+  std::string name;
+  std::string parameter;
+  int iterations;
+  double totalMs;
+};
+
+std::vector<BenchResult> results;
+
+void bench(const std::string &name, const std::string &parameter, int iterations, std::function<void()> setup,
+    std::function<void()> body) {
+  double totalMs = 0;
+  for (int i = 0; i < iterations; i++) {
+    if (setup) setup();
+    auto start = std::chrono::steady_clock::now();
+    body();
+    auto stop = std::chrono::steady_clock::now();
+    totalMs += std::chrono::duration<double, std::milli>(stop - start).count();
+  }
+  results.push_back( { name, parameter, iterations, totalMs });
+}
+
+TCanvas* createGridCanvas(int nx, int ny) {
+  static int counter = 0;
+  TString name = TString::Format("bench_%d_%dx%d", counter++, nx, ny);
+  TCanvas *c = new TCanvas(name, name, 200 * nx, 150 * ny);
+  c->Divide(nx, ny, 1E-5, 1E-5);
+  for (int i = 1; i <= nx * ny; i++) {
+    c->cd(i);
+    TH1 *h = new TH1D(name + TString::Format("_h%d", i), "Histogram;Coordinate, m;Events", 100, -5, 5);
+    h->FillRandom("gaus", 1000);
+    h->Draw();
+  }
+  c->Update();
+  return c;
+}
+
+void benchAddCanvas(int repetitions) {
+  // Fresh canvas every iteration - creation is not timed
+  for (int n = 1; n <= 10; n++) {
+    TCanvas *c = nullptr;
+    bench("addCanvas", TString::Format("%dx%d", n, n).Data(), repetitions, [&]() {
+      delete c;
+      c = createGridCanvas(n, n);
+    }, [&]() {
+      CanvasHelper::getInstance()->addCanvas(c);
+    });
+    delete c;
+  }
+
+  // Lazy registration only marks the canvas - layout cost moves to the first save
+  CanvasHelper::getInstance()->setLazyRegistration(kTRUE);
+  for (int n = 1; n <= 10; n++) {
+    TCanvas *c = nullptr;
+    bench("addCanvas lazy", TString::Format("%dx%d", n, n).Data(), repetitions, [&]() {
+      delete c;
+      c = createGridCanvas(n, n);
+    }, [&]() {
+      CanvasHelper::getInstance()->addCanvas(c);
+    });
+    delete c;
+  }
+  CanvasHelper::getInstance()->setLazyRegistration(kFALSE);
+}
+
+void benchResizeStorm(int repetitions) {
+  // Immediate layout on every resize signal - measures the layout itself, not the debounce
+  CanvasHelper *helper = CanvasHelper::getInstance();
+  helper->setResizeDelay(0);
+  TCanvas *c = createGridCanvas(4, 4);
+  helper->addCanvas(c);
+  const int steps = 20;
+  bench("resizeStorm", TString::Format("4x4,%d steps", steps).Data(), repetitions, nullptr, [&]() {
+    for (int i = 1; i <= steps; i++) {
+      c->SetCanvasSize(800 + 5 * i, 600 + 3 * i);
+      helper->onCanvasResized();
+    }
+  });
+  helper->setResizeDelay(150);
+  delete c;
+}
+
+void benchStatsRounding(int repetitions) {
+  for (int nLines : { 10, 50, 200 }) {
+    TPaveText *pave = new TPaveText(0, 0, 1, 1, "NBNDC");
+    bench("paveTextValueErrors", TString::Format("%d lines", nLines).Data(), repetitions, [&]() {
+      pave->GetListOfLines()->Delete();
+      for (int i = 0; i < nLines; i++) {
+        pave->AddText(TString::Format("p_{%d} = %.6f #pm %.6f", i, 1.23456789 * (i + 1), 0.0123456 * (i + 1)));
+      }
+    }, [&]() {
+      Round::paveTextValueErrors(pave);
+    });
+    delete pave;
+  }
+}
+
+// Errors with 1 to 4 significant digits over 61 decades plus their closest neighbours - where scalar log10() and
+// getFirstDigit() rounding matters most. Followed by random pairs over 80 decades and special errors
+void createRoundingPairs(std::vector<double> &values, std::vector<double> &errors) {
+  std::mt19937_64 generator(12345);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  for (int decade = -30; decade <= 30; decade++) {
+    for (int mantissa = 1; mantissa < 10000; mantissa++) {
+      const double error = mantissa * std::pow(10, decade - 4);
+      for (int ulps = -3; ulps <= 3; ulps++) {
+        double neighbour = error;
+        for (int i = 0; i < std::abs(ulps); i++) {
+          neighbour = std::nextafter(neighbour, ulps > 0 ? INFINITY : 0);
+        }
+        errors.push_back(neighbour);
+        values.push_back(uniform(generator) * std::pow(10, decade + 3 * uniform(generator)));
+      }
+    }
+  }
+  for (int i = 0; i < 2000000; i++) {
+    errors.push_back(std::pow(10, 40 * uniform(generator)));
+    values.push_back(uniform(generator) * std::pow(10, 40 * uniform(generator)));
+  }
+  for (double error : { 0., -1., (double) INFINITY, (double) NAN }) {
+    errors.push_back(error);
+    values.push_back(1.5);
+  }
+}
+
+int verifyRounding() {
+  std::vector<double> values, errors;
+  createRoundingPairs(values, errors);
+  const size_t n = values.size();
+  std::vector<double> roundedValues(n), roundedErrors(n);
+  std::vector<int> decimals(n);
+  Round::valueErrors(values, errors, roundedValues, roundedErrors, decimals);
+
+  size_t mismatches = 0;
+  for (size_t i = 0; i < n; i++) {
+    // Scalar version is only defined for positive finite errors - others are passed through
+    Bool_t valid = errors[i] > 0 && std::isfinite(errors[i]);
+    std::pair<double, double> expected = valid ? Round::valueError(values[i], errors[i]) : std::make_pair(values[i], errors[i]);
+    int expectedDecimals = valid ? std::max(0, -Round::getDecimalPointShift(errors[i])) : -1;
+    if (std::memcmp(&expected.first, &roundedValues[i], sizeof(double)) != 0
+        || std::memcmp(&expected.second, &roundedErrors[i], sizeof(double)) != 0 || expectedDecimals != decimals[i]) {
+      if (mismatches < 10) {
+        std::cout.precision(17);
+        std::cout << "Mismatch: " << values[i] << " #pm " << errors[i] << " -> scalar " << expected.first << " #pm "
+            << expected.second << " (" << expectedDecimals << "), batch " << roundedValues[i] << " #pm "
+            << roundedErrors[i] << " (" << decimals[i] << ")" << std::endl;
+      }
+      mismatches++;
+    }
+  }
+  std::cout << "Compared " << n << " pairs, " << mismatches << " mismatches" << std::endl;
+  return mismatches == 0 ? 0 : 1;
+}
+
+// Pure layout math - no canvas, no ROOT graphics. Prints failed checks and returns their number
+int verifyLayout() {
+  int failures = 0;
+  auto check = [&](bool condition, const char *what) {
+    if (!condition) {
+      std::cout << "Layout check failed: " << what << std::endl;
+      failures++;
+    }
+  };
+  const CanvasTheme theme;
+
+  Layout::PadInput pad;
+  pad.widthPx = 400;
+  pad.heightPx = 300;
+  pad.hasTitle = kTRUE;
+  pad.hasXAxisTitle = kTRUE;
+  pad.hasYAxisTitle = kTRUE;
+  pad.yAxisMaxLabelWidthPx = 30;
+  pad.paves.push_back( { 150, 66, kPaveAlignRight | kPaveAlignTop });
+  pad.paves.push_back( { 100, 44, kPaveAlignLeft | kPaveAlignBottom });
+  Layout::PadGeometry geometry = Layout::computePad(pad);
+  const Layout::PadLayout &layout = geometry.layout;
+
+  check(layout.leftMarginPx == theme.leftMarginBase + theme.axisTitleVSpace + 30, "left margin holds y title and labels");
+  check(layout.rightMarginPx == theme.marginRight, "right margin");
+  check(layout.topMarginPx == theme.marginTop + theme.titleVSpace, "top margin holds title");
+  check(layout.bottomMarginPx == theme.bottomMarginBase + theme.axisTitleVSpace, "bottom margin holds x title");
+  check(std::abs(layout.marginNdc.left - layout.leftMarginPx / 400.) < 1E-12, "left margin in NDC");
+  check(std::abs(layout.marginNdc.top - layout.topMarginPx / 300.) < 1E-12, "top margin in NDC");
+  check(layout.nDivXMajor == 400 / 75 && layout.nDivYMajor == 300 / 50, "axis divisions follow pad size");
+  check(std::abs(geometry.childPadHeightNdc - (1 - layout.topMarginPx / 300.)) < 1E-12, "child pad height below title");
+  check(geometry.titleTextSize == theme.fontSizeLarge, "canvas title text size");
+  check(geometry.title.y1 < geometry.title.y2 && geometry.title.y2 <= 1, "title box inside pad");
+
+  // Paves stick to the frame corners given by their alignment
+  check(geometry.paves.size() == 2, "one box per pave");
+  const Layout::Box &topRight = geometry.paves[0];
+  check(std::abs(topRight.x2 - (1 - layout.marginNdc.right)) < 1E-12, "right aligned pave touches frame");
+  check(topRight.x1 < topRight.x2 && topRight.y1 < topRight.y2, "top right pave box is not empty");
+  check(topRight.y2 > 1 - layout.marginNdc.top, "top aligned pave covers frame border");
+  const Layout::Box &bottomLeft = geometry.paves[1];
+  check(std::abs(bottomLeft.y1 - layout.marginNdc.bottom) < 1E-12, "bottom aligned pave touches frame");
+  check(bottomLeft.x1 < layout.marginNdc.left && bottomLeft.x2 > bottomLeft.x1, "left aligned pave covers frame border");
+
+  // Hidden shared axes collapse interior margins, sub-pads get smaller title space
+  Layout::PadInput interior = pad;
+  interior.hideXAxis = kTRUE;
+  interior.hideYAxis = kTRUE;
+  Layout::PadLayout interiorLayout = Layout::computePadLayout(interior);
+  check(interiorLayout.leftMarginPx == theme.marginLeft, "hidden y axis collapses left margin");
+  check(interiorLayout.bottomMarginPx == theme.marginBottom, "hidden x axis collapses bottom margin");
+  Layout::PadInput child = pad;
+  child.isChild = kTRUE;
+  Layout::PadGeometry childGeometry = Layout::computePad(child);
+  check(childGeometry.layout.topMarginPx == theme.halfMarginTop + theme.childTitleVSpace, "sub-pad top margin");
+  check(childGeometry.titleTextSize == theme.fontSizeNormal, "sub-pad title text size");
+
+  // Paves do not change the shape. Batch layout gives the same result as single pads
+  Layout::PadInput noPaves = pad;
+  noPaves.paves.clear();
+  check(Layout::getShapeKey(noPaves) == Layout::getShapeKey(pad), "paves are not part of the shape");
+  check(!(Layout::getShapeKey(child) == Layout::getShapeKey(pad)), "sub-pad has its own shape");
+  Layout::PadInput otherTheme = pad;
+  otherTheme.theme = theme.scaled(1.5);
+  check(!(Layout::getShapeKey(otherTheme) == Layout::getShapeKey(pad)), "theme is part of the shape");
+  std::vector<Layout::PadInput> pads(100, pad);
+  pads.push_back(child);
+  std::vector<Layout::PadGeometry> geometries;
+  Layout::computePads(pads, geometries);
+  check(geometries.size() == pads.size(), "one geometry per pad");
+  bool same = true;
+  for (size_t i = 0; i < geometries.size(); i++) {
+    const Layout::PadGeometry &expected = i + 1 < pads.size() ? geometry : childGeometry;
+    const Layout::PadLayout &l = geometries[i].layout;
+    same = same && l.leftMarginPx == expected.layout.leftMarginPx && l.rightMarginPx == expected.layout.rightMarginPx
+        && l.topMarginPx == expected.layout.topMarginPx && l.bottomMarginPx == expected.layout.bottomMarginPx
+        && std::memcmp(&geometries[i].title, &expected.title, sizeof(Layout::Box)) == 0
+        && geometries[i].paves.size() == expected.paves.size()
+        && std::memcmp(geometries[i].paves.data(), expected.paves.data(), expected.paves.size() * sizeof(Layout::Box)) == 0;
+  }
+  check(same, "computePads() matches computePad()");
+
+  std::cout << "Layout checks done, " << failures << " failures" << std::endl;
+  return failures;
+}
+
+void benchRounding(int repetitions) {
+  std::vector<double> values, errors;
+  createRoundingPairs(values, errors);
+  const size_t n = values.size();
+  std::vector<double> roundedValues(n), roundedErrors(n);
+  std::vector<int> decimals(n);
+  TString parameter = TString::Format("%zu pairs", n);
+  bench("valueError scalar", parameter.Data(), repetitions, nullptr, [&]() {
+    for (size_t i = 0; i < n; i++) {
+      std::pair<double, double> pair = Round::valueError(values[i], errors[i]);
+      roundedValues[i] = pair.first;
+      roundedErrors[i] = pair.second;
+    }
+  });
+  bench("valueErrors batch", parameter.Data(), repetitions, nullptr, [&]() {
+    Round::valueErrors(values, errors, roundedValues, roundedErrors, decimals);
+  });
+}
+
+void benchLegendMeasurement(int repetitions) {
+  for (int nEntries : { 10, 100, 1000 }) {
+    TLegend *legend = new TLegend(0.1, 0.1, 0.9, 0.9);
+    for (int i = 0; i < nEntries; i++) {
+      legend->AddEntry((TObject*) nullptr, TString::Format("Entry #%d with #alpha_{%d} label", i, i), "l");
+    }
+    bench("legendWidth cold", TString::Format("%d entries", nEntries).Data(), repetitions, []() {
+      CanvasHelper::clearTextExtentCache();
+    }, [&]() {
+      BenchCanvasHelper::getLegendWidthPx(legend);
+    });
+    bench("legendWidth warm", TString::Format("%d entries", nEntries).Data(), repetitions, nullptr, [&]() {
+      BenchCanvasHelper::getLegendWidthPx(legend);
+    });
+    delete legend;
+  }
+}
+
+void benchSaveCanvas(int repetitions) {
+  TCanvas *c = createGridCanvas(2, 2);
+  CanvasHelper::getInstance()->addCanvas(c);
+  std::vector<std::pair<std::string, UInt_t>> formats = { { "png", kFormatPng }, { "ps", kFormatPs }, { "pdf", kFormatPdf }, {
+      "root", kFormatROOT }, { "c", kFormatC }, { "all", kFormatPng | kFormatPs | kFormatPdf | kFormatROOT | kFormatC } };
+  for (auto const &format : formats) {
+    bench("saveCanvas", format.first, repetitions, nullptr, [&]() {
+      CanvasHelper::saveCanvas(c, format.second);
+    });
+  }
+  delete c;
+}
+
+void printResults(const std::string &outputFormat) {
+  if (outputFormat == "json") {
+    std::cout << "[" << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+      const BenchResult &r = results[i];
+      std::cout << "  {\"benchmark\": \"" << r.name << "\", \"parameter\": \"" << r.parameter << "\", \"iterations\": "
+          << r.iterations << ", \"total_ms\": " << r.totalMs << ", \"mean_ms\": " << r.totalMs / r.iterations << "}"
+          << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    std::cout << "]" << std::endl;
+    return;
+  }
+  std::cout << "benchmark,parameter,iterations,total_ms,mean_ms" << std::endl;
+  for (const BenchResult &r : results) {
+    std::cout << r.name << ",\"" << r.parameter << "\"," << r.iterations << "," << r.totalMs << ","
+        << r.totalMs / r.iterations << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string outputFormat = argc > 1 ? argv[1] : "csv";
+  if (outputFormat == "verify") {
+    int status = verifyRounding();
+    return verifyLayout() == 0 ? status : 1;
+  }
+  int repetitions = argc > 2 ? std::stoi(argv[2]) : 5;
+
+  // No display - everything is painted off-screen
+  gROOT->SetBatch(kTRUE);
+  int appArgc = 1;
+  TApplication app("bench", &appArgc, argv);
+  gStyle->SetOptFit(111);
+
+  // Exported files go to the temp directory
+  TString outputDir = TString::Format("%s/canvasHelperBench", gSystem->TempDirectory());
+  gSystem->mkdir(outputDir, kTRUE);
+  gSystem->ChangeDirectory(outputDir);
+
+  benchAddCanvas(repetitions);
+  benchResizeStorm(repetitions);
+  benchStatsRounding(repetitions);
+  benchRounding(repetitions);
+  benchLegendMeasurement(repetitions);
+  benchSaveCanvas(repetitions);
+
+  printResults(outputFormat);
+  return 0;
+}
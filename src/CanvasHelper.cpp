@@ -14,10 +14,20 @@
 #include <TGaxis.h>
 #include <TPad.h>
 #include <TSystem.h>
-#include <TPRegexp.h>
 #include <TLegendEntry.h>
+#include <TFile.h>
+#include <TKey.h>
+#include <TClass.h>
+#include <TTimer.h>
+#include <TTree.h>
+#include <TTF.h>
+#include <Buttons.h>
+#ifdef R__USE_IMT
+#include <ROOT/TThreadExecutor.hxx>
+#endif
 
 #include <TH1.h>
+#include <TH2.h>
 #include <THStack.h>
 #include <TGraph.h>
 #include <TMultiGraph.h>
@@ -27,9 +37,54 @@
 #include <iostream>
 #include <sstream>
 #include <limits>
+#include <list>
+#include <unordered_map>
 
 #include <chrono>
 #include <thread>
+#include <set>
+#include <iomanip>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <tuple>
+#include <cstdint>
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+// Diagnostics. In release builds (NDEBUG) messages are compiled out entirely
+#ifdef NDEBUG
+#define CH_LOG(category, level, message) do {} while (0)
+#define CH_LOG_ENABLED(category, level) kFALSE
+#else
+namespace {
+  Int_t logLevel = CanvasHelper::kLogWarning;
+  UInt_t logCategories = CanvasHelper::kLogAll;
+
+  const char* getLogCategoryName(UInt_t category) {
+    switch (category) {
+      case CanvasHelper::kLogLayout: return "layout";
+      case CanvasHelper::kLogMeasurement: return "measurement";
+      case CanvasHelper::kLogExport: return "export";
+      case CanvasHelper::kLogRegistry: return "registry";
+    }
+    return "";
+  }
+}
+#define CH_LOG_ENABLED(category, level) ((logCategories & (category)) && logLevel >= (level))
+#define CH_LOG(category, level, message) \
+  do { \
+    if (CH_LOG_ENABLED(category, level)) \
+      std::cout << "CanvasHelper [" << getLogCategoryName(category) << "] " << message << std::endl; \
+  } while (0)
+#endif
 
 ClassImp(TNamedLine);
 
@@ -39,6 +94,26 @@ TNamedLine::TNamedLine(const char* name, Double_t x1, Double_t y1, Double_t x2,
 
 TNamedLine::~TNamedLine(){};
 
+namespace {
+  // 10^n lookup for the batch rounding kernel - same values pow(10, n) gives to the scalar version
+  const int kPow10Min = -310;
+  const int kPow10Max = 310;
+
+  struct Pow10Table {
+    double values[kPow10Max - kPow10Min + 1];
+    Pow10Table() {
+      for (int n = kPow10Min; n <= kPow10Max; n++) {
+        values[n - kPow10Min] = pow(10, (double) n);
+      }
+    }
+  };
+
+  const Pow10Table pow10Table;
+
+  // Marks batch lanes that have to go through the scalar code path
+  const int kUnsettledLane = INT_MIN;
+}
+
 namespace Round {
   int getFirstDigit(double number) {
     // We obtain the first digit of the error (always positive)
@@ -58,11 +133,7 @@ namespace Round {
     return (int) number;
   }
 
-  std::pair<double, double> valueError(const double value, const double error) {
-    // If error is zero - return as is (avoid infinite loop)
-    if (error == 0){
-      return std::make_pair(value, error);
-    }
+  int getDecimalPointShift(const double error) {
     // First we find the decimal point shift
     int decimalPointShift = int(log10(error)); // This will give "-0.6" for 0.0234 error, "3" for
     // For 0 < error < 1 we need to manually shift to the right
@@ -71,60 +142,527 @@ namespace Round {
     // MEPhI - keep second digit if first is "1"
     if (getFirstDigit(error) == 1)
       decimalPointShift--;
+    return decimalPointShift;
+  }
+
+  std::pair<double, double> valueError(const double value, const double error) {
+    // If error is zero - return as is (avoid infinite loop)
+    if (error == 0){
+      return std::make_pair(value, error);
+    }
+    int decimalPointShift = getDecimalPointShift(error);
 
     // Round error
     double errorRounded = round(error * pow(10, (double) -decimalPointShift));
     double errorReverted = errorRounded * pow(10, (double) decimalPointShift);
 
-    // Do the same operation with value
-    double valueRounded = int(value * pow(10, (double) -decimalPointShift));
+    // Do the same operation with value. Tiny relative nudge keeps already rounded values stable (1.234 * 1000 = 1233.99...)
+    double valueRounded = std::trunc(value * pow(10, (double) -decimalPointShift) * (1 + 1E-12));
     double valueReverted = valueRounded * pow(10, (double) decimalPointShift);
 
     return std::make_pair(valueReverted, errorReverted);
   }
 
-  void paveTextValueErrors(TPaveText *pave) {
+  void valueErrors(std::span<const double> values, std::span<const double> errors, std::span<double> roundedValues,
+      std::span<double> roundedErrors, std::span<int> decimals) {
+    const size_t n = std::min( { values.size(), errors.size(), roundedValues.size(), roundedErrors.size(), decimals.size() });
+    const double *value = values.data();
+    const double *error = errors.data();
+    double *roundedValue = roundedValues.data();
+    double *roundedError = roundedErrors.data();
+    int *decimal = decimals.data();
+    const double *pow10 = pow10Table.values - kPow10Min;
+
+    // Branch-free pass. Decimal exponent is estimated from the binary one and corrected with a single table lookup.
+    // Lanes where scalar log10() or getFirstDigit() may round differently (mantissa close to an integer), zero,
+    // negative, non-finite or extreme errors are marked and settled by the scalar code below
+    for (size_t i = 0; i < n; i++) {
+      const double e = error[i];
+      uint64_t bits;
+      memcpy(&bits, &e, sizeof(bits));
+      const int binaryExponent = int((bits >> 52) & 0x7FF) - 1023;
+      int d = int(std::floor(binaryExponent * 0.30102999566398120));
+      d = d < -300 ? -300 : (d > 300 ? 300 : d);
+      d += e >= pow10[d + 1] ? 1 : 0;
+
+      const double mantissa = e * pow10[-d];
+      const int firstDigit = int(mantissa);
+      const int shift = d - (firstDigit == 1 ? 1 : 0);
+
+      roundedError[i] = round(e * pow10[-shift]) * pow10[shift];
+      roundedValue[i] = std::trunc(value[i] * pow10[-shift] * (1 + 1E-12)) * pow10[shift];
+
+      const bool unsettled = !(e >= 1E-290 && e <= 1E290) || std::abs(mantissa - round(mantissa)) < 1E-9 * mantissa;
+      decimal[i] = unsettled ? kUnsettledLane : (shift < 0 ? -shift : 0);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      if (decimal[i] != kUnsettledLane)
+        continue;
+      if (!(error[i] > 0) || !std::isfinite(error[i])) {
+        roundedValue[i] = value[i];
+        roundedError[i] = error[i];
+        decimal[i] = -1;
+        continue;
+      }
+      std::pair<double, double> pair = valueError(value[i], error[i]);
+      roundedValue[i] = pair.first;
+      roundedError[i] = pair.second;
+      decimal[i] = std::max(0, -getDecimalPointShift(error[i]));
+    }
+  }
+
+  // Floating point std::from_chars() and std::to_chars() need libstdc++ 11 or libc++ 17. Older libraries fall back to
+  // strtod() and snprintf(). Both print the same "%g" style as the stream output used before
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define CH_FLOAT_CHARCONV
+#endif
+
+  // Parses number surrounded by optional spaces. Whole [begin, end) range must be consumed
+  bool parseNumber(const char *begin, const char *end, double &number) {
+    while (begin < end && *begin == ' ') begin++;
+    while (end > begin && *(end - 1) == ' ') end--;
+    if (begin == end)
+      return false;
+#ifdef CH_FLOAT_CHARCONV
+    std::from_chars_result result = std::from_chars(begin, end, number);
+    return result.ec == std::errc() && result.ptr == end && std::isfinite(number);
+#else
+    // strtod() needs a terminated string
+    char copy[64];
+    if (end - begin >= (std::ptrdiff_t) sizeof(copy))
+      return false;
+    memcpy(copy, begin, end - begin);
+    copy[end - begin] = '\0';
+    char *parsed = nullptr;
+    number = strtod(copy, &parsed);
+    return parsed == copy + (end - begin) && std::isfinite(number);
+#endif
+  }
+
+  bool parseValueErrorLine(const char *line, size_t &prefixLength, double &value, double &error) {
+    // Line looks like "<name> = <value> #pm <error>". Last " #pm " and last "= " before it are the separators
+    const char *pm = nullptr;
+    for (const char *p = strstr(line, " #pm "); p != nullptr; p = strstr(p + 1, " #pm ")) {
+      pm = p;
+    }
+    if (pm == nullptr)
+      return false;
+
+    const char *eq = nullptr;
+    for (const char *p = line; p + 1 < pm; p++) {
+      if (p[0] == '=' && p[1] == ' ') eq = p;
+    }
+    if (eq == nullptr)
+      return false;
+
+    prefixLength = eq - line + 1;
+    return parseNumber(eq + 2, pm, value) && parseNumber(pm + 5, line + strlen(line), error);
+  }
+
+  int formatValueError(char *buffer, int size, const double value, const double error) {
+    std::pair<double, double> rounded = valueError(value, error);
+    // Numbers are printed with 6 significant digits and no trailing zeros ("1234.5 #pm 0.12") - same as stream output
+
+    char *p = buffer;
+    char *end = buffer + size;
+    for (int i = 0; i < 2; i++) {
+      double number = (i == 0 ? rounded.first : rounded.second) + 0.0; // turns "-0" into "0"
+#ifdef CH_FLOAT_CHARCONV
+      std::to_chars_result result = std::to_chars(p, end, number, std::chars_format::general, 6);
+      if (result.ec != std::errc())
+        return -1;
+      p = result.ptr;
+#else
+      int length = snprintf(p, end - p, "%g", number);
+      if (length < 0 || length >= end - p)
+        return -1;
+      p += length;
+#endif
+      if (i == 0) {
+        if (end - p < 5)
+          return -1;
+        memcpy(p, " #pm ", 5);
+        p += 5;
+      }
+    }
+    return p - buffer;
+  }
+
+  int paveTextValueErrors(TPaveText *pave) {
+    int rewritten = 0;
     for (TObject *object : *(pave->GetListOfLines())) {
-      if (object->InheritsFrom(TText::Class())) {
-        TText *text = (TText*) object;
-        TString s(text->GetTitle());
-
-        TObjArray *subStrL = TPRegexp("^(.*=) (.*) #pm (.*)$").MatchS(s);
-        const Int_t nrSubStr = subStrL->GetLast() + 1;
-        if (nrSubStr == 4) {
-          const TString before = ((TObjString*) subStrL->At(1))->GetString();
-          const TString value = ((TObjString*) subStrL->At(2))->GetString();
-          const TString error = ((TObjString*) subStrL->At(3))->GetString();
-          // const TString after  = ((TObjString *)subStrL->At(4))->GetString();
-          Double_t val = atof(value.Data());
-          Double_t err = atof(error.Data());
-          std::pair<Double_t, Double_t> pair = Round::valueError(val, err);
-
-          std::stringstream buffer;
-          buffer << before << " " << pair.first << " #pm " << pair.second;
-
-          TString newText((buffer.str()).c_str());
-          text->SetTitle(newText.Data());
+      if (!object->InheritsFrom(TText::Class()))
+        continue;
+      TText *text = (TText*) object;
+      const char *title = text->GetTitle();
+
+      size_t prefixLength;
+      double value, error;
+      if (!parseValueErrorLine(title, prefixLength, value, error) || error < 0)
+        continue;
+
+      char buffer[128];
+      int length = formatValueError(buffer, sizeof(buffer), value, error);
+      if (length < 0)
+        continue;
+
+      // Line that was already rounded stays the same - nothing to do
+      const char *tail = title + prefixLength + 1;
+      if (strlen(tail) == (size_t) length && memcmp(tail, buffer, length) == 0)
+        continue;
+
+      TString newText(title, prefixLength + 1);
+      newText.Append(buffer, length);
+      text->SetTitle(newText.Data());
+      rewritten++;
+    }
+    return rewritten;
+  }
+}
+
+namespace {
+  // Process-wide LRU cache of measured text extents. Key is composed of font, pixel size, text kind and the string.
+  class TextExtentCache {
+    public:
+      Bool_t find(const std::string &key, std::pair<UInt_t, UInt_t> &extent) {
+        auto it = index.find(key);
+        if (it == index.end()) {
+          misses++;
+          return kFALSE;
         }
+        // Move entry to the front - most recently used
+        entries.splice(entries.begin(), entries, it->second);
+        extent = it->second->second;
+        hits++;
+        return kTRUE;
       }
+
+      void insert(const std::string &key, const std::pair<UInt_t, UInt_t> &extent) {
+        if (capacity == 0) return;
+        while (index.size() >= capacity) {
+          index.erase(entries.back().first);
+          entries.pop_back();
+        }
+        entries.emplace_front(key, extent);
+        index[key] = entries.begin();
+      }
+
+      void setCapacity(UInt_t newCapacity) {
+        capacity = newCapacity;
+        while (index.size() > capacity) {
+          index.erase(entries.back().first);
+          entries.pop_back();
+        }
+      }
+
+      void clear() {
+        entries.clear();
+        index.clear();
+        hits = 0;
+        misses = 0;
+      }
+
+      ULong64_t hits = 0;
+      ULong64_t misses = 0;
+
+    private:
+      typedef std::list<std::pair<std::string, std::pair<UInt_t, UInt_t>>> EntryList;
+      EntryList entries;
+      std::unordered_map<std::string, EntryList::iterator> index;
+      UInt_t capacity = 4096;
+  };
+
+  TextExtentCache textExtentCache;
+
+  // Set in forked export workers - prevents workers from forking again
+  Bool_t isExportWorker = kFALSE;
+
+  // FNV-1a hash used for pad fingerprints
+  void hashBytes(ULong64_t &hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < size; i++) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
     }
   }
+
+  void hashValue(ULong64_t &hash, Double_t value) {
+    hashBytes(hash, &value, sizeof(value));
+  }
+
+  void hashString(ULong64_t &hash, const char *string) {
+    if (string) hashBytes(hash, string, strlen(string) + 1);
+  }
+
+  // Report of the canvas currently being laid out. Null when profiling is disabled - all counters below are skipped
+  CanvasHelper::LayoutReport *activeReport = nullptr;
+
+  // Attributes set by CH_SET() since start. Layout functions report the difference - pads without writes are not repainted
+  ULong64_t attributeWrites = 0;
+
+  // Adds wall time of the enclosing scope to a layout phase of the active report
+  class PhaseTimer {
+    public:
+      PhaseTimer(Int_t phase) : phase(phase) {
+        if (activeReport) start = std::chrono::steady_clock::now();
+      }
+      ~PhaseTimer() {
+        if (activeReport)
+          activeReport->phaseMs[phase] += std::chrono::duration<Double_t, std::milli>(std::chrono::steady_clock::now() - start).count();
+      }
+
+    private:
+      Int_t phase;
+      std::chrono::steady_clock::time_point start;
+  };
+
+  // Makes a report active for the enclosing scope and restores the previous one on exit. Passes nested
+  // in an outer pass (e.g. triggered by Update()) record into their own report, or none, without cutting off the outer one
+  class ActiveReportScope {
+    public:
+      ActiveReportScope(CanvasHelper::LayoutReport *report) : previous(activeReport) {
+        activeReport = report;
+      }
+      ~ActiveReportScope() {
+        activeReport = previous;
+      }
+
+    private:
+      CanvasHelper::LayoutReport *previous;
+  };
+
+  const char *layoutPhaseNames[CanvasHelper::kNLayoutPhases] = { "convertAxis", "alignTitle", "alignAllPaves", "setPadMargins",
+      "setPadCustomFrameBorder", "setPadNDivisions", "update" };
+
+  // Steady clock in milliseconds - refresh requests and user events are compared against it
+  Double_t steadyNowMs() {
+    return std::chrono::duration<Double_t, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Canvases with user events during this time are refreshed before others
+  const Double_t kRecentInteractionMs = 2000;
 }
 
+namespace Layout {
+  Int_t getFrameLeftMarginPx(const PadInput &pad) {
+    // Interior pad of a row with shared y axis - no labels, no title
+    if (pad.hideYAxis)
+      return pad.theme.marginLeft;
+
+    // Margin with y axis label offset
+    Int_t leftMargin = pad.theme.leftMarginBase;
+    // Add y axis title offset
+    if (pad.hasYAxisTitle) {
+      leftMargin += pad.theme.axisTitleVSpace;
+    }
+
+    // Add y axis label width
+    leftMargin += pad.yAxisMaxLabelWidthPx;
+    return leftMargin;
+  }
+
+  Int_t getFrameRightMarginPx(const PadInput &pad) {
+    return pad.theme.marginRight;
+  }
+
+  Int_t getFrameTopMarginPx(const PadInput &pad) {
+    const CanvasTheme &theme = pad.theme;
+    Int_t topMargin = pad.isChild ? theme.halfMarginTop : theme.marginTop;
+    if (pad.hasTitle) {
+      topMargin += pad.isChild ? theme.childTitleVSpace : theme.titleVSpace;
+    }
+    if (pad.hasSubtitle) {
+      topMargin += theme.subtitleVSpace;
+    }
+    return topMargin;
+  }
+
+  Int_t getFrameBottomMarginPx(const PadInput &pad) {
+    // Interior pad of a column with shared x axis - no labels, no title
+    if (pad.hideXAxis)
+      return pad.theme.marginBottom;
+
+    // Margin with x axis label height and offset
+    Int_t bottomMargin = pad.theme.bottomMarginBase;
+    if (pad.hasXAxisTitle) {
+      bottomMargin += pad.theme.axisTitleVSpace;
+    }
+    return bottomMargin;
+  }
+
+  Box getTitleBox(const PadInput &pad) {
+    const CanvasTheme &theme = pad.theme;
+    Double_t topTitlePadding = theme.halfMarginTop + theme.titleVSpace;
+    if (pad.isChild)
+      topTitlePadding /= 2;
+    return { 0, 1 - (Int_t) topTitlePadding / pad.heightPx, 1, 1 - theme.halfMarginTop / pad.heightPx };
+  }
+
+  Box getSubtitleBox(const PadInput &pad) {
+    const CanvasTheme &theme = pad.theme;
+    Int_t y2Px = theme.halfMarginTop + (pad.hasTitle ? theme.titleVSpace : 0);
+    Int_t y1Px = y2Px + theme.subtitleVSpace;
+    return { 0, 1 - y1Px / pad.heightPx, 1, 1 - y2Px / pad.heightPx };
+  }
+
+  Box getPaveBox(const PadInput &pad, const PadLayout &layout, const PaveInput &pave) {
+    Box box = { 0, 0, 1, 1 };
+    if (pave.align & kPaveAlignLeft) {
+      // -1 accounts on pixel perfect alignment (replace with border?)
+      box.x1 = (layout.leftMarginPx - 1) / pad.widthPx;
+      box.x2 = (Int_t) (layout.leftMarginPx + pave.widthPx) / pad.widthPx;
+    }
+    if (pave.align & kPaveAlignRight) {
+      box.x2 = 1 - layout.rightMarginPx / pad.widthPx;
+      box.x1 = 1 - (Int_t) (layout.rightMarginPx + pave.widthPx) / pad.widthPx;
+    }
+    if (pave.align & kPaveAlignTop) {
+      box.y2 = 1 - (layout.topMarginPx - 1) / pad.heightPx;
+      box.y1 = 1 - (layout.topMarginPx + pave.heightPx) / pad.heightPx;
+    }
+    if (pave.align & kPaveAlignBottom) {
+      box.y1 = layout.bottomMarginPx / pad.heightPx;
+      box.y2 = (layout.bottomMarginPx + pave.heightPx) / pad.heightPx;
+    }
+    return box;
+  }
+
+  ShapeKey getShapeKey(const PadInput &pad) {
+    const CanvasTheme &theme = pad.theme;
+    return { pad.widthPx, pad.heightPx, getFrameLeftMarginPx(pad), getFrameRightMarginPx(pad), getFrameTopMarginPx(pad),
+             getFrameBottomMarginPx(pad), theme.axisLabelOffset, theme.axisTickLength, theme.marginLeft, pad.hideXAxis,
+             pad.hideYAxis };
+  }
+
+  Bool_t ShapeKey::operator==(const ShapeKey &other) const {
+    return !(*this < other) && !(other < *this);
+  }
+
+  Bool_t ShapeKey::operator<(const ShapeKey &other) const {
+    return std::tie(widthPx, heightPx, leftMarginPx, rightMarginPx, topMarginPx, bottomMarginPx, axisLabelOffset,
+                    axisTickLength, marginLeft, hideXAxis, hideYAxis)
+        < std::tie(other.widthPx, other.heightPx, other.leftMarginPx, other.rightMarginPx, other.topMarginPx,
+                   other.bottomMarginPx, other.axisLabelOffset, other.axisTickLength, other.marginLeft, other.hideXAxis,
+                   other.hideYAxis);
+  }
+
+  PadLayout computePadLayout(const PadInput &pad) {
+    PadLayout layout;
+    layout.leftMarginPx = getFrameLeftMarginPx(pad);
+    layout.rightMarginPx = getFrameRightMarginPx(pad);
+    layout.topMarginPx = getFrameTopMarginPx(pad);
+    layout.bottomMarginPx = getFrameBottomMarginPx(pad);
+    layout.marginNdc.left = layout.leftMarginPx / pad.widthPx;
+    layout.marginNdc.right = layout.rightMarginPx / pad.widthPx;
+    layout.marginNdc.top = layout.topMarginPx / pad.heightPx;
+    layout.marginNdc.bottom = layout.bottomMarginPx / pad.heightPx;
+
+    const CanvasTheme &theme = pad.theme;
+    layout.xLabelOffset = theme.axisLabelOffset / pad.heightPx;
+    layout.yLabelOffset = theme.axisLabelOffset / pad.widthPx;
+    layout.xTickLength = (Double_t) theme.axisTickLength / pad.heightPx;
+    layout.yTickLength = (Double_t) theme.axisTickLength / pad.widthPx;
+    Double_t titleOffsetPx = (Double_t) layout.leftMarginPx - (Double_t) theme.marginLeft + 8;
+    Double_t coefficient = 30.; // Guestimated
+    layout.yTitleOffset = titleOffsetPx / coefficient;
+
+    // One major division per 75 px horizontally and per 50 px vertically
+    layout.nDivXMajor = (Int_t) pad.widthPx / 75;
+    layout.nDivYMajor = (Int_t) pad.heightPx / 50;
+    layout.hideXAxis = pad.hideXAxis;
+    layout.hideYAxis = pad.hideYAxis;
+    return layout;
+  }
+
+  PadGeometry computePad(const PadInput &pad, const PadLayout &layout) {
+    PadGeometry geometry;
+    geometry.layout = layout;
+    geometry.title = getTitleBox(pad);
+    geometry.titleTextSize = pad.isChild ? pad.theme.fontSizeNormal : pad.theme.fontSizeLarge;
+    geometry.subtitle = getSubtitleBox(pad);
+    geometry.paves.reserve(pad.paves.size());
+    for (const PaveInput &pave : pad.paves) {
+      geometry.paves.push_back(getPaveBox(pad, layout, pave));
+    }
+    geometry.childPadHeightNdc = 1 - layout.topMarginPx / pad.heightPx;
+    return geometry;
+  }
+
+  PadGeometry computePad(const PadInput &pad) {
+    return computePad(pad, computePadLayout(pad));
+  }
+
+  void computePads(const std::vector<PadInput> &pads, std::vector<PadGeometry> &geometries) {
+    // Pad layout is a dozen integer operations - computed per pad, sharing it between pads of equal shape costs more
+    geometries.resize(pads.size());
+    auto compute = [&](UInt_t i) {
+      geometries[i] = computePad(pads[i]);
+    };
+#ifdef R__USE_IMT
+    // Not worth waking up the pool for a few canvases
+    if (ROOT::IsImplicitMTEnabled() && pads.size() >= 256) {
+      std::vector<UInt_t> indices(pads.size());
+      for (UInt_t i = 0; i < indices.size(); i++) indices[i] = i;
+      ROOT::TThreadExecutor executor;
+      executor.Foreach(compute, indices);
+      return;
+    }
+#endif
+    for (UInt_t i = 0; i < pads.size(); i++) {
+      compute(i);
+    }
+  }
+
+}
+
+// Set attribute only if it differs from the current value, e.g. CH_SET(axis, LabelSize, 0.05). Value is converted to the
+// getter type first - float attributes are compared the way they are stored
+#define CH_SET(object, attribute, value) \
+  do { \
+    auto chValue = static_cast<decltype((object)->Get##attribute())>(value); \
+    if ((object)->Get##attribute() != chValue) { \
+      (object)->Set##attribute(chValue); \
+      attributeWrites++; \
+    } \
+  } while (0)
+
 ClassImp(CanvasHelper);
 
 // Instance
 CanvasHelper *CanvasHelper::fgInstance = nullptr;
 
 // Constructor
-CanvasHelper::CanvasHelper() {
+CanvasHelper::CanvasHelper() : layoutProfiling(kFALSE), resizeDelay(150), resizeImmediatePass(kFALSE),
+    gridColumnAlignment(kFALSE), lazyRegistration(kFALSE), refreshBudgetMs(10), refreshPeriodMs(40), refreshMaxLatencyMs(1000),
+    refreshStats(), refreshLatencySumMs(0), refreshTickSumMs(0) {
   // Only accept resized signals from TCanvas. Child pads will also send these signals. However we want to omit them
   TQObject::Connect(TCanvas::Class_Name(), "Resized()", this->Class_Name(), this, "onCanvasResized()");
+  TQObject::Connect(TCanvas::Class_Name(), "Closed()", this->Class_Name(), this, "onCanvasClosed()");
+  // Zoom and unzoom change pad ranges - decimated graphs need to be recomputed
+  TQObject::Connect(TPad::Class_Name(), "RangeAxisChanged()", this->Class_Name(), this, "onPadRangeChanged()");
+  // User events - canvases the user works with are refreshed first
+  TQObject::Connect(TCanvas::Class_Name(), "ProcessedEvent(Int_t,Int_t,Int_t,TObject*)", this->Class_Name(), this,
+                    "onCanvasEvent(Int_t,Int_t,Int_t,TObject*)");
+
+  // Synchronous timer - calls HandleTimer() from the event loop
+  resizeTimer = new TTimer(this, resizeDelay, kTRUE);
+  afterPaintTimer = new TTimer(this, 0, kTRUE);
+  refreshTimer = new TTimer(this, refreshPeriodMs, kTRUE);
+
+  // Get notified when registered canvases are deleted
+  gROOT->GetListOfCleanups()->Add(this);
 }
 
 // Destructor
 CanvasHelper::~CanvasHelper() {
-  delete fgInstance;
+  if (gROOT->GetListOfCleanups())
+    gROOT->GetListOfCleanups()->Remove(this);
+  delete resizeTimer;
+  delete afterPaintTimer;
+  delete refreshTimer;
+  // Instance is a function static - only forget the pointer
+  fgInstance = nullptr;
 }
 
 // Instance provider
@@ -136,30 +674,33 @@ CanvasHelper* CanvasHelper::getInstance() {
   return fgInstance;
 }
 
-// All sizes in pixels
-const Int_t CanvasHelper::FONT_SIZE_NORMAL = 16;
-const Int_t CanvasHelper::FONT_SIZE_SMALL = FONT_SIZE_NORMAL * 3. / 4.;
-const Int_t CanvasHelper::FONT_SIZE_SMALLER = FONT_SIZE_SMALL * 3. / 4.;
-const Int_t CanvasHelper::FONT_SIZE_LARGE = FONT_SIZE_NORMAL * 4. / 3.;
-const Int_t CanvasHelper::FONT_SIZE_LARGER = FONT_SIZE_LARGE * 4. / 3.;
-const Int_t CanvasHelper::FONT_SIZE_HUGE = FONT_SIZE_LARGER * 4. / 3.;
-
-constexpr Double_t CanvasHelper::LINE_HEIGHT = 1.2;
+const CanvasTheme& CanvasHelper::getPadTheme(TVirtualPad *pad) {
+  if (fgInstance) {
+    auto entry = fgInstance->registeredCanvases.find(pad->GetCanvas());
+    if (entry != fgInstance->registeredCanvases.end())
+      return entry->second.theme;
+  }
+  return kDefaultTheme;
+}
 
-// const Double_t CanvasHelper::AXIS_TITLE_OFFSET = 64;
-const Int_t CanvasHelper::AXIS_LABEL_OFFSET = 6;
-// const Int_t CanvasHelper::AXIS_TITLE_OFFSET = 25;
-const Int_t CanvasHelper::AXIS_TICK_LENGTH = 20;
+void CanvasHelper::setDefaultTheme(const CanvasTheme &theme) {
+  defaultTheme = theme;
+}
 
-const Int_t CanvasHelper::MARGIN_LEFT = 25;
-const Int_t CanvasHelper::MARGIN_TOP = 30;       // In particular this is for TGaxis::PaintAxis() x10^3 label
-const Int_t CanvasHelper::MARGIN_RIGHT = 40;     // In particular this is for TGaxis::PaintAxis() x10^3 label
-const Int_t CanvasHelper::MARGIN_BOTTOM = 10;
+void CanvasHelper::setCanvasTheme(TCanvas *canvas, const CanvasTheme &theme) {
+  auto entry = registeredCanvases.find(canvas);
+  if (entry == registeredCanvases.end() || entry->second.theme == theme)
+    return;
+  entry->second.theme = theme;
+  // Every pad depends on theme sizes - forget fingerprints so the single pass below lays out all of them
+  entry->second.padFingerprints.clear();
+  processCanvas(canvas);
+}
 
-const Int_t CanvasHelper::TITLE_VSPACE = 25;
-const Int_t CanvasHelper::SUBTITLE_VSPACE = 20;
-const Int_t CanvasHelper::PAVELINE_VSPACE = 22;
-const Int_t CanvasHelper::AXISTITLE_VSPACE = 20;
+const CanvasTheme& CanvasHelper::getCanvasTheme(TCanvas *canvas) const {
+  auto entry = registeredCanvases.find(canvas);
+  return entry != registeredCanvases.end() ? entry->second.theme : kDefaultTheme;
+}
 
 Style_t CanvasHelper::getFont(EFontFace fontFace) {
   // Default font face is 4
@@ -168,53 +709,108 @@ Style_t CanvasHelper::getFont(EFontFace fontFace) {
   return (Int_t) fontFace * 10 + precision;
 }
 
-std::pair<TAxis*, TAxis*> CanvasHelper::getPadXYAxis(TVirtualPad *pad) {
-  TList *primitives = pad->GetListOfPrimitives();
-  TListIter next(primitives);
+CanvasHelper::PadModel CanvasHelper::buildPadModel(TVirtualPad *pad) {
+  PadModel model;
+  model.pad = pad;
+  model.widthPx = getPadWidthPx(pad);
+  model.heightPx = getPadHeightPx(pad);
+  model.isChild = isChildPad(pad);
+  model.theme = &getPadTheme(pad);
+
+  // Single pass over primitives - classify everything alignment functions need
+  TListIter next(pad->GetListOfPrimitives());
   TObject *object;
   while ((object = next())) {
-    if (object->InheritsFrom(TH1::Class())) {
-      TH1 *hist = (TH1*) object;
-      return std::make_pair<TAxis*, TAxis*>(hist->GetXaxis(), hist->GetYaxis());
+    if (activeReport) activeReport->primitivesScanned++;
+    const char *name = object->GetName();
+    if (!model.title && strcmp(name, "title") == 0) {
+      model.title = object;
+      continue;
     }
-    if (object->InheritsFrom(THStack::Class())) {
-      THStack *stack = (THStack*) object;
-      TAxis *yAxis = stack->GetYaxis();
-      // Fix TStack not having Y axis limits
-      yAxis->SetLimits(stack->GetMinimum(), stack->GetMaximum());
-      return std::make_pair<TAxis*, TAxis*>(stack->GetXaxis(), stack->GetYaxis());
+    if (!model.subtitle && strcmp(name, "subtitle") == 0) {
+      model.subtitle = object;
+      continue;
     }
-    if (object->InheritsFrom(TGraph::Class())) {
-      TGraph *graph = (TGraph*) object;
-      return std::make_pair<TAxis*, TAxis*>(graph->GetXaxis(), graph->GetYaxis());
+
+    // Obtain axis from pad (could be histogram, Stack, Graph...). First object with axes wins
+    if (!model.xAxis) {
+      if (object->InheritsFrom(TH1::Class())) {
+        TH1 *hist = (TH1*) object;
+        model.xAxis = hist->GetXaxis();
+        model.yAxis = hist->GetYaxis();
+        model.plot = object;
+        continue;
+      }
+      if (object->InheritsFrom(THStack::Class())) {
+        THStack *stack = (THStack*) object;
+        // Fix TStack not having Y axis limits
+        stack->GetYaxis()->SetLimits(stack->GetMinimum(), stack->GetMaximum());
+        model.xAxis = stack->GetXaxis();
+        model.yAxis = stack->GetYaxis();
+        model.plot = object;
+        continue;
+      }
+      if (object->InheritsFrom(TGraph::Class())) {
+        TGraph *graph = (TGraph*) object;
+        model.xAxis = graph->GetXaxis();
+        model.yAxis = graph->GetYaxis();
+        model.plot = object;
+        continue;
+      }
+      if (object->InheritsFrom(TMultiGraph::Class())) {
+        TMultiGraph *mgraph = (TMultiGraph*) object;
+        model.xAxis = mgraph->GetXaxis();
+        model.yAxis = mgraph->GetYaxis();
+        model.plot = object;
+        continue;
+      }
+      if (object->InheritsFrom(TF1::Class())) {
+        TF1 *func = (TF1*) object;
+        model.xAxis = func->GetXaxis();
+        model.yAxis = func->GetYaxis();
+        model.plot = object;
+        continue;
+      }
     }
-    if (object->InheritsFrom(TMultiGraph::Class())) {
-      TMultiGraph *mgraph = (TMultiGraph*) object;
-      return std::make_pair<TAxis*, TAxis*>(mgraph->GetXaxis(), mgraph->GetYaxis());
+
+    if (object->InheritsFrom(TPave::Class())) {
+      // Do not process title, subtitle and axis titles
+      TString paveName = name;
+      if (!paveName.Contains("title"))
+        model.paves.push_back((TPave*) object);
+      continue;
     }
-    if (object->InheritsFrom(TF1::Class())) {
-      TF1 *func = (TF1*) object;
-      return std::make_pair<TAxis*, TAxis*>(func->GetXaxis(), func->GetYaxis());
+    if (!model.frame && object->InheritsFrom(TFrame::Class())) {
+      model.frame = (TFrame*) object;
+      continue;
+    }
+    if (object->InheritsFrom(TLine::Class())) {
+      if (strcmp(name, "frameTopLine") == 0)
+        model.frameTopLine = (TLine*) object;
+      else if (strcmp(name, "frameRightLine") == 0)
+        model.frameRightLine = (TLine*) object;
     }
   }
-  return std::make_pair(nullptr, nullptr);
-}
 
-Double_t CanvasHelper::getYAxisMaxLabelWidthPx(TVirtualPad *pad) {
-  // Obtain axis from pad (could be histogram, Stack, Graph...)
-  TAxis *xaxis = getPadXYAxis(pad).first;
-  TAxis *yaxis = getPadXYAxis(pad).second;
-  if (!yaxis)
-    return 0;
+  // Title may also be owned by one of the primitives (e.g. histogram list of functions)
+  if (!model.title)
+    model.title = pad->GetPrimitive("title");
+  // Same for subtitles attached below the top level
+  if (!model.subtitle)
+    model.subtitle = pad->GetPrimitive("subtitle");
 
+  if (model.yAxis)
+    model.yAxisMaxLabelWidthPx = getYAxisMaxLabelWidthPx(pad, *model.theme);
+  return model;
+}
+
+Double_t CanvasHelper::getYAxisMaxLabelWidthPx(TVirtualPad *pad, const CanvasTheme &theme) {
+  // Labels only depend on the pad range - cheap enough for live pads to call on every repaint
   Double_t axisLabelMax = 100;
   Double_t axisLabelMin = 100;
   if (!pad->GetLogy()) {
     Double_t pMax = pad->GetUymax();
     Double_t pMin = pad->GetUymin();
-    Int_t nDiv = yaxis->GetNdivisions();
-    Int_t N2 = nDiv / 100;
-    Int_t N1 = nDiv % 100;
 
     Double_t majorDivisionSize = std::abs(pMax - pMin);
     // We round axis maximum value to the major division step and get pretty much what the maximum label is
@@ -243,17 +839,7 @@ Double_t CanvasHelper::getYAxisMaxLabelWidthPx(TVirtualPad *pad) {
 //  }
 
   // Determine longest label width in pixels
-  TText *t = new TText(0.5, 0.5, axisLongestLabel.c_str());
-  t->SetNDC();
-  t->SetTextFont(getFont());
-  t->SetTextSize(FONT_SIZE_NORMAL);
-  // t->SetTextSizePixels(FONT_SIZE_NORMAL);
-  // t->Draw();
-  UInt_t w = 0, h = 0;
-  t->GetBoundingBox(w, h);
-  // UInt_t w = getTextWidthPx(t);
-
-  return w;
+  return getTextExtentPx(axisLongestLabel.c_str(), getFont(), theme.fontSizeNormal, kFALSE).first;
 }
 
 // Todo - improve like done for
@@ -292,83 +878,235 @@ Double_t CanvasHelper::getPadHeightPx(TVirtualPad *virtualPad) {
   return 0;
 }
 
-void CanvasHelper::addCanvas(TCanvas *canvas) {
+void CanvasHelper::addCanvas(TCanvas *canvas, UInt_t sharedAxes) {
   if (canvas == nullptr) return;
 
-  // Update Pad - in case the histogram was just drawn - need to update otherwise no primitives
-  // Force unconditionally paint canvas
-  canvas->cd()->Paint();
-
-  // Weird but this makes TTF::GetTextExtent() return correct value
-  TText *t = new TText(1.5, 0.5, "Hi!");
-  t->SetNDC();
-  t->SetTextFont(getFont());
-  t->SetTextSize(FONT_SIZE_NORMAL);
-  canvas->GetListOfPrimitives()->Add(t);
-  canvas->Paint();
-
-  registeredCanvases.insert( { canvas, { canvas->GetWw(), canvas->GetWh() } });
+  // Canvas destructor will notify us via RecursiveRemove()
+  canvas->SetBit(kMustCleanup);
+  CanvasEntry &entry = registeredCanvases[canvas];
+  entry.width = canvas->GetWw();
+  entry.height = canvas->GetWh();
+  entry.theme = defaultTheme;
+  entry.sharedAxes = sharedAxes;
+  entry.layoutPending = kTRUE;
+  CH_LOG(kLogRegistry, kLogInfo, "Canvas \"" << canvas->GetName() << "\" added, " << registeredCanvases.size() << " registered");
+
+  // Lazy canvases are laid out on first paint or save
+  if (!lazyRegistration)
+    runPendingLayout(canvas);
+}
+
+void CanvasHelper::setLazyRegistration(Bool_t enable) {
+  lazyRegistration = enable;
+}
+
+Bool_t CanvasHelper::runPendingLayout(TCanvas *canvas) {
+  auto entry = registeredCanvases.find(canvas);
+  if (entry == registeredCanvases.end() || !entry->second.layoutPending)
+    return kFALSE;
+  entry->second.layoutPending = kFALSE;
+  pendingFirstLayouts.erase(canvas);
+  entry->second.width = canvas->GetWw();
+  entry->second.height = canvas->GetWh();
+
+  // Text is measured relative to gPad
+  canvas->cd();
+
+  // In case the histogram was just drawn - frame, title and stats box only appear after the first paint
+  if (needsFirstPaint(canvas)) {
+    CH_LOG(kLogRegistry, kLogDebug, "Canvas \"" << canvas->GetName() << "\" was not painted since last change, painting once");
+    canvas->Paint();
+  }
   processCanvas(canvas);
+  return kTRUE;
 }
 
-Bool_t CanvasHelper::isChildPad(TVirtualPad *pad) {
-  // If global title was added to a multi-pad canvas
-  TPMERegexp name_re("_\\d+");
-  if (name_re.Match(pad->GetName())) {
-    return kTRUE;
+void CanvasHelper::processFirstLayouts() {
+  std::set<TCanvas*> canvases;
+  canvases.swap(pendingFirstLayouts);
+  for (TCanvas *canvas : canvases) {
+    runPendingLayout(canvas);
   }
-  // If global title was added to a multi-pad canvas
-  TString motherName = pad->GetMother()->GetName();
-  if (motherName.Contains("_child")) {
+}
+
+Bool_t CanvasHelper::needsFirstPaint(TVirtualPad *pad) {
+  // Pads modified since their last paint may lack stats boxes or titles of newly drawn objects
+  if (pad->IsModified())
     return kTRUE;
+  // Painted pads with plots always have a frame in their primitives
+  Bool_t hasPlot = kFALSE;
+  Bool_t hasFrame = kFALSE;
+  TListIter next(pad->GetListOfPrimitives());
+  TObject *object;
+  while ((object = next())) {
+    if (object->InheritsFrom(TVirtualPad::Class())) {
+      if (needsFirstPaint((TVirtualPad*) object))
+        return kTRUE;
+    } else if (object->InheritsFrom(TFrame::Class())) {
+      hasFrame = kTRUE;
+    } else if (object->InheritsFrom(TH1::Class()) || object->InheritsFrom(TGraph::Class())
+        || object->InheritsFrom(THStack::Class()) || object->InheritsFrom(TMultiGraph::Class())
+        || object->InheritsFrom(TF1::Class())) {
+      hasPlot = kTRUE;
+    }
   }
-  return kFALSE;
+  return hasPlot && !hasFrame;
 }
 
-void CanvasHelper::alignTitle(TVirtualPad *pad) {
-  TObject *object = pad->GetPrimitive("title");
-  if (!object || !object->InheritsFrom(TPaveText::Class()))
-    return;
+Bool_t CanvasHelper::isChildPad(TVirtualPad *pad) {
+  const PadNode *node = findPadNode(pad);
+  if (node)
+    return node->isChild;
+  // Pad of unregistered canvas - every pad except canvas and multi-title container is a child
+  return pad != pad->GetCanvas() && !(pad->GetMother() == pad->GetCanvas() && pad->GetNumber() == -1);
+}
 
-  TPaveText *title = (TPaveText*) object;
-  title->SetTextFont(getFont());
+ULong64_t CanvasHelper::getPadTreeSignature(TVirtualPad *pad) {
+  // Pointers, numbers, names and primitive counts of all pads in the tree. A pad deleted and re-created at the same
+  // address is caught by its name or contents. No geometry - cheap enough to check every pass
+  ULong64_t hash = 14695981039346656037ULL;
+  std::vector<TVirtualPad*> stack = { pad };
+  while (!stack.empty()) {
+    TVirtualPad *parent = stack.back();
+    stack.pop_back();
+    TList *primitives = parent->GetListOfPrimitives();
+    Int_t number = parent->GetNumber();
+    Int_t nPrimitives = primitives ? primitives->GetSize() : 0;
+    hashBytes(hash, &parent, sizeof(parent));
+    hashBytes(hash, &number, sizeof(number));
+    hashBytes(hash, &nPrimitives, sizeof(nPrimitives));
+    hashString(hash, parent->GetName());
+    if (!primitives)
+      continue;
+    TListIter next(primitives);
+    TObject *object;
+    while ((object = next())) {
+      if (!object->InheritsFrom(TVirtualPad::Class()))
+        continue;
+      TVirtualPad *subPad = (TVirtualPad*) object;
+      hashBytes(hash, &subPad, sizeof(subPad));
+      stack.push_back(subPad);
+    }
+  }
+  return hash;
+}
 
-  title->SetTextSize(isChildPad(pad) ? FONT_SIZE_NORMAL : FONT_SIZE_LARGE);
+void CanvasHelper::indexSubPads(TVirtualPad *parent, Int_t depth, PadIndex &index) {
+  std::vector<TVirtualPad*> subPads;
+  TListIter next(parent->GetListOfPrimitives());
+  TObject *object;
+  while ((object = next())) {
+    if (object->InheritsFrom(TVirtualPad::Class()))
+      subPads.push_back((TVirtualPad*) object);
+  }
+  if (subPads.empty())
+    return;
 
-  title->SetFillStyle(kFEmpty);
-  title->SetTextAlign(ETextAlign::kHAlignCenter + ETextAlign::kVAlignCenter);
+  // Grid columns and rows are ranks of distinct lower left corners among siblings (pads made by TPad::Divide())
+  std::vector<Double_t> xLows, yLows;
+  for (TVirtualPad *subPad : subPads) {
+    xLows.push_back(subPad->GetXlowNDC());
+    yLows.push_back(subPad->GetYlowNDC());
+  }
+  auto distinct = [](std::vector<Double_t> &values) {
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end(), [](Double_t a, Double_t b) {
+      return std::abs(a - b) < 1E-6;
+    }), values.end());
+  };
+  distinct(xLows);
+  distinct(yLows);
+  auto rank = [](const std::vector<Double_t> &values, Double_t value) {
+    return (Int_t) (std::lower_bound(values.begin(), values.end(), value - 1E-6) - values.begin());
+  };
+
+  for (TVirtualPad *subPad : subPads) {
+    PadNode &node = index.nodes[subPad];
+    node.parent = parent;
+    node.depth = depth;
+    node.column = rank(xLows, subPad->GetXlowNDC());
+    node.row = (Int_t) yLows.size() - 1 - rank(yLows, subPad->GetYlowNDC());
+    // addMultiCanvasTitle() marks its container pad with number -1
+    node.isMultiTitleContainer = depth == 1 && subPad->GetNumber() == -1;
+    node.isChild = !node.isMultiTitleContainer;
+    if (node.isMultiTitleContainer)
+      index.multiTitlePad = subPad;
+    indexSubPads(subPad, depth + 1, index);
+  }
+}
 
-//    title->SetX1NDC(pxToNdcHorizontal(getFrameLeftMarginPx(pad), pad));
-//    title->SetX2NDC(1 - pxToNdcHorizontal(getFrameRightMarginPx(), pad));
+void CanvasHelper::buildPadIndex(TCanvas *canvas, PadIndex &index) {
+  index.nodes.clear();
+  index.layoutPads.clear();
+  index.multiTitlePad = nullptr;
+  index.nodes[canvas] = PadNode();
+  indexSubPads(canvas, 1, index);
 
-  title->SetX1NDC(0);
-  title->SetX2NDC(1);
+  // If canvas has multi title then its sub pads dont belong to it, but to the container pad
+  TVirtualPad *layoutParent = index.multiTitlePad ? index.multiTitlePad : canvas;
+  for (Int_t i = 1;; i++) {
+    TVirtualPad *subPad = layoutParent->GetPad(i);
+    if (!subPad)
+      break;
+    index.layoutPads.push_back(subPad);
+  }
+  index.signature = getPadTreeSignature(canvas);
+  CH_LOG(kLogLayout, kLogDebug, "Pad index of \"" << canvas->GetName() << "\" rebuilt, " << index.nodes.size() << " pads");
+}
 
-  title->SetY2NDC(1 - pxToNdcVertical(MARGIN_TOP / 2 + 0, pad));
+const CanvasHelper::PadIndex& CanvasHelper::getPadIndex(TCanvas *canvas) {
+  // Unregistered canvases get a scratch index rebuilt on every call
+  static PadIndex scratchIndex;
+  auto entry = registeredCanvases.find(canvas);
+  if (entry == registeredCanvases.end()) {
+    buildPadIndex(canvas, scratchIndex);
+    return scratchIndex;
+  }
+  PadIndex &index = entry->second.padIndex;
+  if (index.nodes.empty() || index.signature != getPadTreeSignature(canvas))
+    buildPadIndex(canvas, index);
+  return index;
+}
 
-  Double_t topTitlePadding = MARGIN_TOP / 2 + TITLE_VSPACE;
-  if (isChildPad(pad))
-    topTitlePadding /= 2;
-  title->SetY1NDC(1 - pxToNdcVertical(topTitlePadding, pad));
+const CanvasHelper::PadNode* CanvasHelper::findPadNode(TVirtualPad *pad) {
+  if (!fgInstance)
+    return nullptr;
+  auto entry = fgInstance->registeredCanvases.find(pad->GetCanvas());
+  if (entry == fgInstance->registeredCanvases.end())
+    return nullptr;
+  auto node = entry->second.padIndex.nodes.find(pad);
+  return node != entry->second.padIndex.nodes.end() ? &node->second : nullptr;
 }
 
-void CanvasHelper::alignSubtitle(TPaveText *subtitle, TVirtualPad *pad) {
-  // subtitle->SetX1NDC(pxToNdcHorizontal(getFrameLeftMarginPx(pad), pad));
-  // subtitle->SetX2NDC(1 - pxToNdcHorizontal(getFrameRightMarginPx(), pad));
-  subtitle->SetX1NDC(0);
-  subtitle->SetX2NDC(1);
+void CanvasHelper::alignTitle(const PadModel &model, const PadGeometry &geometry) {
+  TObject *object = model.title;
+  if (!object || !object->InheritsFrom(TPaveText::Class()))
+    return;
+
+  TPaveText *title = (TPaveText*) object;
+  CH_SET(title, TextFont, getFont());
+  CH_SET(title, TextSize, geometry.titleTextSize);
+
+  CH_SET(title, FillStyle, kFEmpty);
+  CH_SET(title, TextAlign, ETextAlign::kHAlignCenter + ETextAlign::kVAlignCenter);
 
-  std::pair<Double_t, Double_t> subtitleYCoords = getSubtitleYNDCCoordinates(pad);
-  subtitle->SetY1NDC(subtitleYCoords.first);
-  subtitle->SetY2NDC(subtitleYCoords.second);
+  CH_SET(title, X1NDC, geometry.title.x1);
+  CH_SET(title, X2NDC, geometry.title.x2);
+  CH_SET(title, Y1NDC, geometry.title.y1);
+  CH_SET(title, Y2NDC, geometry.title.y2);
 }
 
-void CanvasHelper::alignSubtitle(TVirtualPad *pad) {
-  TObject *object = pad->GetPrimitive("subtitle");
+void CanvasHelper::alignSubtitle(const PadModel &model, const PadGeometry &geometry) {
+  TObject *object = model.subtitle;
   if (!object || !object->InheritsFrom(TPave::Class()))
     return;
 
-  alignSubtitle((TPaveText*) object, pad);
+  TPaveText *subtitle = (TPaveText*) object;
+  CH_SET(subtitle, TextSize, model.theme->fontSizeNormal);
+  CH_SET(subtitle, X1NDC, geometry.subtitle.x1);
+  CH_SET(subtitle, X2NDC, geometry.subtitle.x2);
+  CH_SET(subtitle, Y1NDC, geometry.subtitle.y1);
+  CH_SET(subtitle, Y2NDC, geometry.subtitle.y2);
 }
 
 //void CanvasHelper::alignAxisTitles(TVirtualPad *pad) {
@@ -404,120 +1142,1426 @@ void CanvasHelper::alignSubtitle(TVirtualPad *pad) {
 //    }
 //}
 
-std::pair<Double_t, Double_t> CanvasHelper::getSubtitleYNDCCoordinates(TVirtualPad *pad) {
-  Bool_t padHasTitle = pad->GetPrimitive("title") != nullptr;
+void CanvasHelper::addSubtitle(TVirtualPad *pad, const char *text) {
+  Layout::Box box = Layout::getSubtitleBox(getLayoutInput(buildPadModel(pad), kFALSE));
+  TPaveText *subtitle = new TPaveText(box.x1, box.y1, box.x2, box.y2, "NBNDC"); // ndc coordinates
+  subtitle->SetTextAlign(kHAlignCenter + kVAlignCenter);
+  subtitle->SetName("subtitle");
+  subtitle->SetFillStyle(kFEmpty);
+  subtitle->SetLineWidth(0);
+  subtitle->SetTextFont(getFont());
+  subtitle->SetTextSize(getPadTheme(pad).fontSizeNormal);
+  subtitle->SetTextColor(kGray + 2);
+  subtitle->SetFillStyle(kFEmpty);
+  subtitle->SetLineWidth(0);
+  subtitle->AddText(text);
+
+  pad->cd();
+  subtitle->Draw();
+
+  // pad->GetListOfPrimitives()->Add(subtitle);        // attach subtitle to pad primitives otherwise alignment wont work
+  // pad->Update();
+
+  // subtitle->Print();
+
+  // Tweak top margin
+  PadModel model = buildPadModel(pad);
+  setPadMargins(model, computePadLayout(model));
+}
+
+void CanvasHelper::onCanvasResized() {
+  // Every Pad will emit this signal. Supposedly child canvas pads as well.
+  // We need to listen to only parent canvas signal to eliminate doing things multiple times
+  // Deleted canvases are already removed from the registry in RecursiveRemove()
+  for (auto &entry : registeredCanvases) {
+    UInt_t currentWidth = entry.first->GetWw();
+    UInt_t currentHeight = entry.first->GetWh();
+    UInt_t oldWidth = entry.second.width;
+    UInt_t oldHeight = entry.second.height;
+    if (currentWidth != oldWidth || currentHeight != oldHeight) {
+      entry.second.width = currentWidth;
+      entry.second.height = currentHeight;
+      entry.second.lastInteractionMs = steadyNowMs();
+      // Not laid out yet - first layout uses the final size anyway
+      if (entry.second.layoutPending)
+        continue;
+      if (resizeDelay <= 0) {
+        processCanvas(entry.first);
+        continue;
+      }
+      if (resizeImmediatePass) {
+        processCanvasMargins(entry.first);
+      }
+      pendingResizes.insert(entry.first);
+    }
+  }
+
+  // Restart quiet period - layout happens once resize signals stop coming
+  if (!pendingResizes.empty()) {
+    resizeTimer->Start(resizeDelay, kTRUE);
+  }
+}
+
+Bool_t CanvasHelper::HandleTimer(TTimer *timer) {
+  if (timer == afterPaintTimer) {
+    processFirstLayouts();
+    processLivePads();
+    return kTRUE;
+  }
+  if (timer == refreshTimer) {
+    processRefreshQueue();
+    return kTRUE;
+  }
+  if (timer != resizeTimer)
+    return kFALSE;
+
+  // Canvases only get here once per burst with their final size
+  std::set<TCanvas*> canvases;
+  canvases.swap(pendingResizes);
+  for (TCanvas *canvas : canvases) {
+    if (registeredCanvases.find(canvas) != registeredCanvases.end())
+      processCanvas(canvas);
+  }
+  return kTRUE;
+}
+
+void CanvasHelper::processCanvasMargins(TCanvas *canvas) {
+  // Cheap pass - only keep frame margins in pixels while canvas is being resized
+  const PadIndex &padIndex = getPadIndex(canvas);
+  ULong64_t canvasWritesBefore = attributeWrites;
+  alignChildPad(canvas);
+  for (TVirtualPad *subPad : padIndex.layoutPads) {
+    PadModel model = buildPadModel(subPad);
+    ULong64_t writesBefore = attributeWrites;
+    setPadMargins(model, computePadLayout(model));
+    if (attributeWrites != writesBefore)
+      subPad->Modified();
+  }
+  PadModel model = buildPadModel(canvas);
+  ULong64_t writesBefore = attributeWrites;
+  setPadMargins(model, computePadLayout(model));
+  if (attributeWrites != writesBefore)
+    canvas->Modified();
+  // One repaint for all pads
+  if (attributeWrites != canvasWritesBefore)
+    canvas->Update();
+}
+
+void CanvasHelper::onCanvasClosed() {
+  TCanvas *canvas = dynamic_cast<TCanvas*>((TObject*) gTQSender);
+  removeCanvas(canvas);
+}
+
+void CanvasHelper::onPadRangeChanged() {
+  // Emitted on every paint of a pad with axes. Only pads showing display objects with a different range are scheduled
+  TVirtualPad *pad = dynamic_cast<TVirtualPad*>((TObject*) gTQSender);
+  if (!pad)
+    return;
+  auto entry = registeredCanvases.find(pad->GetCanvas());
+  if (entry != registeredCanvases.end() && entry->second.layoutPending) {
+    // First real paint of a lazily registered canvas - lay it out as soon as painting is over
+    if (pendingFirstLayouts.insert(entry->first).second)
+      afterPaintTimer->Start(0, kTRUE);
+    return;
+  }
+  if (entry != registeredCanvases.end() && entry->second.liveMode)
+    checkLivePad(entry->first, entry->second, pad);
+  auto displayPad = displayPads.find(pad);
+  if (displayPad == displayPads.end() || displayPad->second.rangeKey == getDisplayRangeKey(getDisplayRange(pad)))
+    return;
+  // Never relayout from within painting - reuse the resize timer
+  pendingResizes.insert(displayPad->second.canvas);
+  resizeTimer->Start(TMath::Max(resizeDelay, 0L), kTRUE);
+}
+
+void CanvasHelper::onCanvasEvent(Int_t event, Int_t, Int_t, TObject*) {
+  // Emitted for every mouse move as well - only count real interaction
+  if (event == kMouseMotion || event == kMouseEnter || event == kMouseLeave)
+    return;
+  auto entry = registeredCanvases.find(dynamic_cast<TCanvas*>((TObject*) gTQSender));
+  if (entry != registeredCanvases.end())
+    entry->second.lastInteractionMs = steadyNowMs();
+}
+
+void CanvasHelper::RecursiveRemove(TObject *object) {
+  // Called for every deleted object with kMustCleanup bit - keep it O(1)
+  if (!displaySwaps.empty())
+    forgetDisplayObject(object);
+  if (registeredCanvases.erase((TCanvas*) object) > 0) {
+    pendingResizes.erase((TCanvas*) object);
+    pendingLiveCanvases.erase((TCanvas*) object);
+    pendingFirstLayouts.erase((TCanvas*) object);
+    refreshQueue.erase((TCanvas*) object);
+    CH_LOG(kLogRegistry, kLogInfo, "Canvas deleted, " << registeredCanvases.size() << " registered");
+  }
+}
+
+void CanvasHelper::removeCanvas(TCanvas *canvas) {
+  // Canvas stays alive - give it its original objects back
+  restoreDisplayObjects(canvas);
+  if (registeredCanvases.erase(canvas) > 0) {
+    pendingResizes.erase(canvas);
+    pendingLiveCanvases.erase(canvas);
+    pendingFirstLayouts.erase(canvas);
+    refreshQueue.erase(canvas);
+    CH_LOG(kLogRegistry, kLogInfo, "Canvas removed, " << registeredCanvases.size() << " registered");
+  }
+}
+
+Bool_t CanvasHelper::isCanvasRegistered(TCanvas *canvas) const {
+  return registeredCanvases.find(canvas) != registeredCanvases.end();
+}
+
+ULong64_t CanvasHelper::getAttributesWrittenCount(TCanvas *canvas) const {
+  auto it = registeredCanvases.find(canvas);
+  return it != registeredCanvases.end() ? it->second.attributesWritten : 0;
+}
+
+UInt_t CanvasHelper::getSkippedPadsCount(TCanvas *canvas) const {
+  auto it = registeredCanvases.find(canvas);
+  return it != registeredCanvases.end() ? it->second.skippedPads : 0;
+}
+
+void CanvasHelper::setLayoutProfiling(Bool_t enable) {
+  layoutProfiling = enable;
+}
+
+CanvasHelper::LayoutReport CanvasHelper::getLayoutReport(TCanvas *canvas) const {
+  auto it = registeredCanvases.find(canvas);
+  return it != registeredCanvases.end() ? it->second.report : LayoutReport();
+}
+
+void CanvasHelper::printLayoutReports() const {
+  std::cout << std::left << std::setw(20) << "canvas";
+  for (Int_t i = 0; i < kNLayoutPhases; i++) {
+    std::cout << std::right << std::setw(12) << layoutPhaseNames[i];
+  }
+  std::cout << std::setw(12) << "total" << std::setw(12) << "texts" << std::setw(12) << "primitives" << std::setw(12)
+      << "allocated" << std::setw(12) << "pads" << std::setw(12) << "skipped" << std::setw(12) << "shapes"
+      << std::setw(12) << "written" << std::setw(12) << "repainted" << std::endl;
+  for (auto const &entry : registeredCanvases) {
+    const LayoutReport &r = entry.second.report;
+    std::cout << std::left << std::setw(20) << entry.first->GetName() << std::right << std::fixed << std::setprecision(3);
+    for (Int_t i = 0; i < kNLayoutPhases; i++) {
+      std::cout << std::setw(12) << r.phaseMs[i];
+    }
+    std::cout << std::setw(12) << r.totalMs << std::setw(12) << r.textMeasurements << std::setw(12) << r.primitivesScanned
+        << std::setw(12) << r.objectsAllocated << std::setw(12) << r.padsProcessed << std::setw(12) << r.padsSkipped << std::setw(12) << r.layoutClasses
+        << std::setw(12) << r.attributesWritten << std::setw(12) << r.padsRepainted << std::endl;
+  }
+  std::cout.unsetf(std::ios_base::floatfield);
+}
+
+void CanvasHelper::requestRefresh(TCanvas *canvas) {
+  if (!isCanvasRegistered(canvas)) {
+    CH_LOG(kLogRegistry, kLogWarning, "Refresh of unregistered canvas ignored");
+    return;
+  }
+  refreshStats.requests++;
+  // Objects were refilled - possibly in place, without any change visible to the display cache
+  invalidateDisplayObjects(canvas);
+  // Merged request keeps the time of the first one - latency is measured from there
+  if (!refreshQueue.emplace(canvas, steadyNowMs()).second) {
+    refreshStats.merged++;
+    return;
+  }
+  refreshStats.maxQueueDepth = TMath::Max(refreshStats.maxQueueDepth, (UInt_t) refreshQueue.size());
+  // Timer is running already if queue was not empty. Restarting it would postpone the tick on every request
+  if (refreshQueue.size() == 1)
+    refreshTimer->Start(refreshPeriodMs, kTRUE);
+}
+
+void CanvasHelper::setRefreshBudget(Double_t budgetMs, Long_t periodMs, Double_t maxLatencyMs) {
+  refreshBudgetMs = TMath::Max(budgetMs, 0.);
+  refreshPeriodMs = TMath::Max(periodMs, 0L);
+  refreshMaxLatencyMs = TMath::Max(maxLatencyMs, 0.);
+}
+
+CanvasHelper::RefreshStats CanvasHelper::getRefreshStats() const {
+  RefreshStats stats = refreshStats;
+  stats.queueDepth = refreshQueue.size();
+  stats.meanLatencyMs = stats.refreshes > 0 ? refreshLatencySumMs / stats.refreshes : 0;
+  stats.meanTickMs = stats.ticks > 0 ? refreshTickSumMs / stats.ticks : 0;
+  return stats;
+}
+
+void CanvasHelper::resetRefreshStats() {
+  refreshStats = RefreshStats();
+  refreshStats.maxQueueDepth = refreshQueue.size();
+  refreshLatencySumMs = 0;
+  refreshTickSumMs = 0;
+}
+
+void CanvasHelper::processRefreshQueue() {
+  Double_t tickStart = steadyNowMs();
+
+  // Rank: starved requests, recent interaction, shown on screen. Oldest request first within a rank
+  struct Request {
+    TCanvas *canvas;
+    Double_t requestMs;
+    Int_t rank;
+  };
+  std::vector<Request> requests;
+  requests.reserve(refreshQueue.size());
+  for (const auto &queued : refreshQueue) {
+    TCanvas *canvas = queued.first;
+    Int_t rank = 0;
+    if (tickStart - queued.second >= refreshMaxLatencyMs)
+      rank = 3;
+    else {
+      auto entry = registeredCanvases.find(canvas);
+      if (entry != registeredCanvases.end() && entry->second.lastInteractionMs >= 0
+          && tickStart - entry->second.lastInteractionMs < kRecentInteractionMs)
+        rank = 2;
+      else if (!canvas->IsBatch() && canvas->GetCanvasImp())
+        rank = 1;
+    }
+    requests.push_back({ canvas, queued.second, rank });
+  }
+  std::sort(requests.begin(), requests.end(), [](const Request &a, const Request &b) {
+    return a.rank != b.rank ? a.rank > b.rank : a.requestMs < b.requestMs;
+  });
+
+  UInt_t refreshed = 0;
+  for (const Request &request : requests) {
+    // At least one canvas per tick so that the queue always moves
+    if (refreshed > 0 && steadyNowMs() - tickStart >= refreshBudgetMs)
+      break;
+    // Canvas could have been deleted by a previous refresh - RecursiveRemove() drops its request
+    if (refreshQueue.erase(request.canvas) == 0)
+      continue;
+    refreshCanvas(request.canvas);
+    refreshed++;
+
+    Double_t latencyMs = steadyNowMs() - request.requestMs;
+    refreshStats.refreshes++;
+    refreshLatencySumMs += latencyMs;
+    refreshStats.maxLatencyMs = TMath::Max(refreshStats.maxLatencyMs, latencyMs);
+  }
+
+  Double_t tickMs = steadyNowMs() - tickStart;
+  refreshStats.ticks++;
+  refreshTickSumMs += tickMs;
+  refreshStats.maxTickMs = TMath::Max(refreshStats.maxTickMs, tickMs);
+  CH_LOG(kLogLayout, kLogDebug, "Refresh tick " << refreshed << " canvases in " << tickMs << " ms, " << refreshQueue.size() << " waiting");
+
+  // Remaining canvases go next tick. Requests that arrived during this tick are in the queue too
+  if (!refreshQueue.empty()) {
+    refreshStats.deferredTicks++;
+    refreshTimer->Start(refreshPeriodMs, kTRUE);
+  }
+}
+
+void CanvasHelper::refreshCanvas(TCanvas *canvas) {
+  auto entry = registeredCanvases.find(canvas);
+  if (entry == registeredCanvases.end())
+    return;
+  runPendingLayout(canvas);
+  // Sub-pads are only repainted when modified themselves
+  for (TVirtualPad *pad : getPadIndex(canvas).layoutPads)
+    pad->Modified();
+  canvas->Modified();
+  // Live canvases check their labels while painting. Otherwise changed pads are laid out, unchanged ones are skipped.
+  // Layout pass ends with the only canvas update of the refresh
+  if (entry->second.liveMode)
+    canvas->Update();
+  else
+    processCanvas(canvas);
+}
+
+TTree* CanvasHelper::getLayoutReportsTree() const {
+  TTree *tree = new TTree("layoutReports", "CanvasHelper layout cost reports");
+  tree->SetDirectory(nullptr);
+
+  Char_t canvasName[256];
+  LayoutReport r;
+  tree->Branch("canvas", canvasName, "canvas/C");
+  for (Int_t i = 0; i < kNLayoutPhases; i++) {
+    tree->Branch(TString::Format("%sMs", layoutPhaseNames[i]), &r.phaseMs[i], TString::Format("%sMs/D", layoutPhaseNames[i]));
+  }
+  tree->Branch("totalMs", &r.totalMs, "totalMs/D");
+  tree->Branch("textMeasurements", &r.textMeasurements, "textMeasurements/l");
+  tree->Branch("primitivesScanned", &r.primitivesScanned, "primitivesScanned/l");
+  tree->Branch("objectsAllocated", &r.objectsAllocated, "objectsAllocated/l");
+  tree->Branch("padsProcessed", &r.padsProcessed, "padsProcessed/i");
+  tree->Branch("padsSkipped", &r.padsSkipped, "padsSkipped/i");
+  tree->Branch("layoutClasses", &r.layoutClasses, "layoutClasses/i");
+  tree->Branch("attributesWritten", &r.attributesWritten, "attributesWritten/l");
+  tree->Branch("padsRepainted", &r.padsRepainted, "padsRepainted/i");
+
+  for (auto const &entry : registeredCanvases) {
+    strncpy(canvasName, entry.first->GetName(), sizeof(canvasName) - 1);
+    canvasName[sizeof(canvasName) - 1] = '\0';
+    r = entry.second.report;
+    tree->Fill();
+  }
+  // Branch buffers point to local variables
+  tree->ResetBranchAddresses();
+  return tree;
+}
+
+UInt_t CanvasHelper::getRegisteredCanvasesCount() const {
+  return registeredCanvases.size();
+}
+
+std::vector<TCanvas*> CanvasHelper::getRegisteredCanvases() const {
+  std::vector<TCanvas*> canvases;
+  canvases.reserve(registeredCanvases.size());
+  for (auto const &entry : registeredCanvases) {
+    canvases.push_back(entry.first);
+  }
+  return canvases;
+}
+
+void CanvasHelper::setResizeDelay(Long_t milliseconds) {
+  resizeDelay = milliseconds;
+}
+
+void CanvasHelper::setResizeImmediatePass(Bool_t enable) {
+  resizeImmediatePass = enable;
+}
+
+void CanvasHelper::setSharedAxes(TCanvas *canvas, UInt_t sharedAxes) {
+  auto entry = registeredCanvases.find(canvas);
+  if (entry == registeredCanvases.end() || entry->second.sharedAxes == sharedAxes)
+    return;
+  entry->second.sharedAxes = sharedAxes;
+  processCanvas(canvas);
+}
+
+void CanvasHelper::setGridColumnAlignment(Bool_t enable) {
+  if (gridColumnAlignment == enable)
+    return;
+  gridColumnAlignment = enable;
+  // Label widths of the next pass differ from the remembered ones
+  for (auto &entry : registeredCanvases) {
+    entry.second.padFingerprints.clear();
+  }
+}
+
+void CanvasHelper::setGraphDecimation(TCanvas *canvas, Bool_t enable) {
+  auto entry = registeredCanvases.find(canvas);
+  if (entry == registeredCanvases.end() || entry->second.graphDecimation == enable)
+    return;
+  entry->second.graphDecimation = enable;
+  processCanvas(canvas);
+}
+
+void CanvasHelper::setHistogramRebinning(TCanvas *canvas, Bool_t enable) {
+  auto entry = registeredCanvases.find(canvas);
+  if (entry == registeredCanvases.end() || entry->second.histogramRebinning == enable)
+    return;
+  entry->second.histogramRebinning = enable;
+  processCanvas(canvas);
+}
+
+void CanvasHelper::setLiveMode(TCanvas *canvas, Bool_t enable, UInt_t maxPadsPerRefresh) {
+  auto entry = registeredCanvases.find(canvas);
+  if (entry == registeredCanvases.end())
+    return;
+  entry->second.liveBudget = TMath::Max(maxPadsPerRefresh, 1U);
+  if (entry->second.liveMode == enable)
+    return;
+  entry->second.liveMode = enable;
+  entry->second.livePads.clear();
+  entry->second.pendingLivePads.clear();
+  pendingLiveCanvases.erase(canvas);
+  // Full pass records label buckets of every pad (or exact label widths when live mode is turned off)
+  entry->second.padFingerprints.clear();
+  processCanvas(canvas);
+}
+
+Double_t CanvasHelper::getLiveBucketPx(const CanvasTheme &theme) {
+  // About the width of one digit
+  return TMath::Max(1., std::ceil(theme.fontSizeNormal / 2.));
+}
+
+Bool_t CanvasHelper::applyLiveLabelWidth(LivePad &live, PadModel &model) {
+  live.yMin = model.pad->GetUymin();
+  live.yMax = model.pad->GetUymax();
+  live.logY = model.pad->GetLogy();
+  live.hasYAxis = model.yAxis != nullptr;
+
+  // Wider labels need a wider margin right away. Narrower labels only when two buckets narrower
+  Double_t step = getLiveBucketPx(*model.theme);
+  Int_t bucket = (Int_t) std::ceil(model.yAxisMaxLabelWidthPx / step);
+  Bool_t changed = live.bucket < 0 || bucket > live.bucket || bucket <= live.bucket - 2;
+  if (changed)
+    live.bucket = bucket;
+  model.yAxisMaxLabelWidthPx = live.bucket * step;
+  return changed;
+}
+
+void CanvasHelper::checkLivePad(TCanvas *canvas, CanvasEntry &entry, TVirtualPad *pad) {
+  // Runs on every repaint - only pads laid out before, and only when the y range changed
+  auto live = entry.livePads.find(pad);
+  if (live == entry.livePads.end() || !live->second.hasYAxis)
+    return;
+  LivePad &state = live->second;
+  if (state.yMin == pad->GetUymin() && state.yMax == pad->GetUymax() && state.logY == pad->GetLogy())
+    return;
+  state.yMin = pad->GetUymin();
+  state.yMax = pad->GetUymax();
+  state.logY = pad->GetLogy();
+
+  const CanvasTheme &theme = getPadTheme(pad);
+  Double_t step = getLiveBucketPx(theme);
+  Int_t bucket = (Int_t) std::ceil(getYAxisMaxLabelWidthPx(pad, theme) / step);
+  if (bucket <= state.bucket && bucket > state.bucket - 2)
+    return;
+
+  // Never relayout from within painting
+  CH_LOG(kLogLayout, kLogDebug, "Live pad \"" << pad->GetName() << "\" label bucket " << state.bucket << " -> " << bucket);
+  entry.pendingLivePads.insert(pad);
+  pendingLiveCanvases.insert(canvas);
+  afterPaintTimer->Start(0, kTRUE);
+}
+
+void CanvasHelper::processLivePads() {
+  std::set<TCanvas*> canvases;
+  canvases.swap(pendingLiveCanvases);
+  for (TCanvas *canvas : canvases) {
+    auto entry = registeredCanvases.find(canvas);
+    if (entry == registeredCanvases.end() || !entry->second.liveMode)
+      continue;
+    CanvasEntry &canvasEntry = entry->second;
+
+    // Pads of aligned columns and shared axes depend on each other - full pass, unchanged pads are skipped anyway
+    if (gridColumnAlignment || canvasEntry.sharedAxes != 0) {
+      canvasEntry.pendingLivePads.clear();
+      processCanvas(canvas);
+      continue;
+    }
+
+    const PadIndex &padIndex = getPadIndex(canvas);
+    UInt_t budget = canvasEntry.liveBudget;
+    UInt_t writes = 0;
+    while (budget > 0 && !canvasEntry.pendingLivePads.empty()) {
+      TVirtualPad *pad = *canvasEntry.pendingLivePads.begin();
+      canvasEntry.pendingLivePads.erase(canvasEntry.pendingLivePads.begin());
+      // Pad may have been deleted since it was scheduled
+      auto node = padIndex.nodes.find(pad);
+      if (node == padIndex.nodes.end() || node->second.isMultiTitleContainer)
+        continue;
+
+      PadModel model = buildPadModel(pad);
+      applyLiveLabelWidth(canvasEntry.livePads[pad], model);
+      UInt_t styleWrites = stylePaves(model);
+      writes += processPad(model, Layout::computePad(getLayoutInput(model)), styleWrites);
+      PadModel after = buildPadModel(pad);
+      after.yAxisMaxLabelWidthPx = model.yAxisMaxLabelWidthPx;
+      canvasEntry.padFingerprints[pad] = getPadFingerprint(after);
+      budget--;
+    }
+    // Laid out pads are repainted together
+    if (writes > 0)
+      canvas->Update();
+    if (!canvasEntry.pendingLivePads.empty())
+      pendingLiveCanvases.insert(canvas);
+  }
+
+  // Remaining pads next iteration of the event loop
+  if (!pendingLiveCanvases.empty())
+    afterPaintTimer->Start(0, kTRUE);
+}
+
+CanvasHelper::DisplayRange CanvasHelper::getDisplayRange(TVirtualPad *pad) {
+  DisplayRange range;
+  Double_t frameWidthPx = getPadWidthPx(pad) * (1 - pad->GetLeftMargin() - pad->GetRightMargin());
+  Double_t frameHeightPx = getPadHeightPx(pad) * (1 - pad->GetTopMargin() - pad->GetBottomMargin());
+  range.columns = TMath::Max(1, TMath::Nint(frameWidthPx));
+  range.rows = TMath::Max(1, TMath::Nint(frameHeightPx));
+  range.xMin = pad->GetUxmin();
+  range.xMax = pad->GetUxmax();
+  range.yMin = pad->GetUymin();
+  range.yMax = pad->GetUymax();
+  range.logX = pad->GetLogx();
+  range.logY = pad->GetLogy();
+  return range;
+}
+
+ULong64_t CanvasHelper::getDisplayRangeKey(const DisplayRange &range) {
+  ULong64_t hash = 14695981039346656037ULL;
+  hashValue(hash, range.columns);
+  hashValue(hash, range.rows);
+  hashValue(hash, range.xMin);
+  hashValue(hash, range.xMax);
+  hashValue(hash, range.yMin);
+  hashValue(hash, range.yMax);
+  hashValue(hash, range.logX);
+  hashValue(hash, range.logY);
+  return hash;
+}
+
+void CanvasHelper::hashGraphState(ULong64_t &hash, TGraph *graph) {
+  // Point count, arrays (reallocated by Set() and AddPoint()) and user minimum and maximum. Points are never read
+  Int_t n = graph->GetN();
+  const Double_t *x = graph->GetX();
+  const Double_t *y = graph->GetY();
+  hashValue(hash, n);
+  hashBytes(hash, &x, sizeof(x));
+  hashBytes(hash, &y, sizeof(y));
+  hashValue(hash, graph->GetMinimum());
+  hashValue(hash, graph->GetMaximum());
+}
+
+ULong64_t CanvasHelper::getDisplayKey(TObject *original, ULong64_t rangeKey) {
+  // Cheap state only - the key is checked on every layout pass and must cost much less than rebuilding the display.
+  // In-place edits (SetPoint(), SetBinContent()) are caught by Modified() on the pad or by requestRefresh()
+  ULong64_t hash = 14695981039346656037ULL;
+  hashBytes(hash, &rangeKey, sizeof(rangeKey));
+  if (original->IsA() == TGraph::Class()) {
+    hashGraphState(hash, (TGraph*) original);
+  } else if (original->InheritsFrom(TH1::Class())) {
+    // Filling changes entries and statistics (sumw, sumw2, sumwx, sumwx2...)
+    TH1 *histogram = (TH1*) original;
+    hashValue(hash, histogram->GetNcells());
+    hashValue(hash, histogram->GetSumw2N());
+    hashValue(hash, histogram->GetEntries());
+    Double_t stats[TH1::kNstat] = {};
+    histogram->GetStats(stats);
+    hashBytes(hash, stats, sizeof(stats));
+  }
+  return hash;
+}
+
+void CanvasHelper::invalidateDisplayObjects(TCanvas *canvas) {
+  // Zero key never matches - displays of the canvas are rebuilt by the next layout pass
+  for (auto &swap : displaySwaps) {
+    if (swap.second.canvas == canvas)
+      swap.second.key = 0;
+  }
+}
+
+Bool_t CanvasHelper::isRebinnableHistogram(TObject *object) {
+  // Profiles average their bins and labelled axes are categories - neither can be merged by maximum
+  if (!object->InheritsFrom(TH1::Class()) || object->InheritsFrom("TProfile") || object->InheritsFrom("TProfile2D"))
+    return kFALSE;
+  TH1 *histogram = (TH1*) object;
+  if (histogram->GetDimension() > 2 || histogram->GetXaxis()->GetLabels())
+    return kFALSE;
+  return histogram->GetDimension() == 1 || !histogram->GetYaxis()->GetLabels();
+}
+
+TObject* CanvasHelper::createDisplayObject(TObject *original, const DisplayRange &range) {
+  if (original->IsA() == TGraph::Class())
+    return decimateGraph((TGraph*) original, range);
+  if (isRebinnableHistogram(original))
+    return rebinHistogram((TH1*) original, range);
+  return nullptr;
+}
+
+TGraph* CanvasHelper::decimateGraph(TGraph *graph, const DisplayRange &range) {
+  // Not worth it - painting a few points per pixel column is cheap
+  const Int_t columns = range.columns;
+  const Double_t xMin = range.xMin, xMax = range.xMax;
+  const Bool_t logX = range.logX;
+  Int_t n = graph->GetN();
+  if (n <= 4 * columns || xMax <= xMin)
+    return nullptr;
+
+  // Scatter plots can not be decimated by columns
+  const Double_t *x = graph->GetX();
+  const Double_t *y = graph->GetY();
+  for (Int_t i = 1; i < n; i++) {
+    if (x[i] < x[i - 1])
+      return nullptr;
+  }
+
+  // Visible points. Points outside the frame are only needed to draw lines towards the frame edges
+  Double_t lo = logX ? std::pow(10., xMin) : xMin;
+  Double_t hi = logX ? std::pow(10., xMax) : xMax;
+  Int_t first = (Int_t) (std::lower_bound(x, x + n, lo) - x);
+  Int_t last = (Int_t) (std::upper_bound(x, x + n, hi) - x);
+  Double_t columnWidth = (xMax - xMin) / columns;
+  auto getColumn = [&](Double_t value) {
+    Double_t u = logX ? std::log10(value) : value;
+    return TMath::Min(columns - 1, TMath::Max(0, (Int_t) ((u - xMin) / columnWidth)));
+  };
+
+  std::vector<Double_t> dx, dy;
+  dx.reserve(4 * columns + 4);
+  dy.reserve(4 * columns + 4);
+  Int_t lastAdded = -1;
+  auto add = [&](Int_t i) {
+    if (i <= lastAdded || i < 0 || i >= n)
+      return;
+    dx.push_back(x[i]);
+    dy.push_back(y[i]);
+    lastAdded = i;
+  };
+  add(0);
+  add(first - 1);
+
+  // First, last, minimum and maximum point of every pixel column in the order of the original data
+  for (Int_t i = first; i < last;) {
+    Int_t column = getColumn(x[i]);
+    Int_t iMin = i, iMax = i, j = i + 1;
+    for (; j < last && getColumn(x[j]) == column; j++) {
+      if (y[j] < y[iMin]) iMin = j;
+      if (y[j] > y[iMax]) iMax = j;
+    }
+    add(i);
+    add(TMath::Min(iMin, iMax));
+    add(TMath::Max(iMin, iMax));
+    add(j - 1);
+    i = j;
+  }
+
+  add(last);
+  add(n - 1);
+
+  TGraph *display = new TGraph((Int_t) dx.size(), dx.data(), dy.data());
+  if (activeReport) activeReport->objectsAllocated++;
+  display->SetNameTitle(graph->GetName(), graph->GetTitle());
+  graph->TAttLine::Copy(*display);
+  graph->TAttFill::Copy(*display);
+  graph->TAttMarker::Copy(*display);
+  if (graph->GetMinimum() != -1111) display->SetMinimum(graph->GetMinimum());
+  if (graph->GetMaximum() != -1111) display->SetMaximum(graph->GetMaximum());
+  CH_LOG(kLogLayout, kLogDebug, "Graph \"" << graph->GetName() << "\" decimated from " << n << " to " << dx.size() << " points");
+  return display;
+}
+
+Bool_t CanvasHelper::getDisplayBinGroups(TAxis *axis, Int_t pixels, Double_t min, Double_t max, Bool_t log,
+    std::vector<Int_t> &starts) {
+  // Visible bins are merged in groups of equal number of bins, so that there is about one group per pixel.
+  // Bins outside the frame only need to be there for unzooming - they are merged into as many groups again
+  Int_t nBins = axis->GetNbins();
+  Double_t lo = log ? std::pow(10., min) : min;
+  Double_t hi = log ? std::pow(10., max) : max;
+  Int_t first = TMath::Max(1, axis->FindFixBin(lo));
+  Int_t last = TMath::Min(nBins, axis->FindFixBin(hi));
+  if (last < first) {
+    first = 1;
+    last = nBins;
+  }
+  Int_t groupSize = (last - first + 1 + pixels - 1) / pixels;
+
+  starts.clear();
+  auto addGroups = [&](Int_t from, Int_t to, Int_t size) {
+    for (Int_t bin = from; bin <= to; bin += size) {
+      starts.push_back(bin);
+    }
+  };
+  addGroups(1, first - 1, TMath::Max(1, (first - 1 + pixels - 1) / pixels));
+  addGroups(first, last, groupSize);
+  addGroups(last + 1, nBins, TMath::Max(1, (nBins - last + pixels - 1) / pixels));
+  starts.push_back(nBins + 1);
+  return groupSize > 1;
+}
+
+TH1* CanvasHelper::rebinHistogram(TH1 *histogram, const DisplayRange &range) {
+  Bool_t is2D = histogram->GetDimension() == 2;
+  TAxis *xAxis = histogram->GetXaxis();
+  TAxis *yAxis = histogram->GetYaxis();
+  std::vector<Int_t> xStarts, yStarts = { 1, 2 };
+  Bool_t mergeX = getDisplayBinGroups(xAxis, range.columns, range.xMin, range.xMax, range.logX, xStarts);
+  Bool_t mergeY = is2D && getDisplayBinGroups(yAxis, range.rows, range.yMin, range.yMax, range.logY, yStarts);
+  if (!mergeX && !mergeY)
+    return nullptr;
+
+  // Edges of the display bins are edges of the original bins - zoom ranges map exactly between both
+  auto getEdges = [](TAxis *axis, const std::vector<Int_t> &starts) {
+    std::vector<Double_t> edges;
+    edges.reserve(starts.size());
+    for (Int_t start : starts) {
+      edges.push_back(axis->GetBinLowEdge(start));
+    }
+    return edges;
+  };
+  std::vector<Double_t> xEdges = getEdges(xAxis, xStarts);
+  Int_t nx = (Int_t) xEdges.size() - 1;
+  Int_t ny = (Int_t) yStarts.size() - 1;
+  TH1 *display = nullptr;
+  if (is2D) {
+    std::vector<Double_t> yEdges = getEdges(yAxis, yStarts);
+    display = new TH2D(histogram->GetName(), histogram->GetTitle(), nx, xEdges.data(), ny, yEdges.data());
+  } else {
+    display = new TH1D(histogram->GetName(), histogram->GetTitle(), nx, xEdges.data());
+  }
+  if (activeReport) activeReport->objectsAllocated++;
+  display->SetDirectory(nullptr);
+  Bool_t hasErrors = histogram->GetSumw2N() > 0;
+  if (hasErrors)
+    display->Sumw2();
+
+  // Every display bin keeps the maximum of its original bins (and the error of that bin)
+  for (Int_t gx = 0; gx < nx; gx++) {
+    for (Int_t gy = 0; gy < ny; gy++) {
+      Int_t maxBin = -1;
+      Double_t maxContent = 0;
+      for (Int_t bx = xStarts[gx]; bx < xStarts[gx + 1]; bx++) {
+        for (Int_t by = yStarts[gy]; by < yStarts[gy + 1]; by++) {
+          Int_t bin = is2D ? histogram->GetBin(bx, by) : bx;
+          Double_t content = histogram->GetBinContent(bin);
+          if (maxBin < 0 || content > maxContent) {
+            maxBin = bin;
+            maxContent = content;
+          }
+        }
+      }
+      Int_t displayBin = is2D ? display->GetBin(gx + 1, gy + 1) : gx + 1;
+      display->SetBinContent(displayBin, maxContent);
+      if (hasErrors)
+        display->SetBinError(displayBin, histogram->GetBinError(maxBin));
+    }
+  }
+
+  // Statistics box shows the original histogram
+  Double_t stats[TH1::kNstat] = {};
+  histogram->GetStats(stats);
+  display->PutStats(stats);
+  display->SetEntries(histogram->GetEntries());
+
+  histogram->TAttLine::Copy(*display);
+  histogram->TAttFill::Copy(*display);
+  histogram->TAttMarker::Copy(*display);
+  display->SetStats(!histogram->TestBit(TH1::kNoStats));
+  if (histogram->GetMinimumStored() != -1111) display->SetMinimum(histogram->GetMinimumStored());
+  if (histogram->GetMaximumStored() != -1111) display->SetMaximum(histogram->GetMaximumStored());
+  if (histogram->TestBit(TH1::kUserContour)) {
+    std::vector<Double_t> levels(histogram->GetContour());
+    histogram->GetContour(levels.data());
+    display->SetContour((Int_t) levels.size(), levels.data());
+  }
+  CH_LOG(kLogLayout, kLogDebug, "Histogram \"" << histogram->GetName() << "\" rebinned from " << histogram->GetNcells()
+      << " to " << display->GetNcells() << " cells");
+  return display;
+}
+
+void CanvasHelper::moveDisplayState(TObject *from, TObject *to, Bool_t keepSource) {
+  // Axes (titles, zoom, layout) and attached functions and stats boxes travel with whatever object is painted
+  TList *sourceFunctions = nullptr;
+  TList *targetFunctions = nullptr;
+  if (from->IsA() == TGraph::Class() && to->IsA() == TGraph::Class()) {
+    // Graph axes live in its histogram. SetHistogram() does not delete the previous one
+    TGraph *source = (TGraph*) from;
+    TGraph *target = (TGraph*) to;
+    TH1F *targetHistogram = target->GetHistogram();
+    if (keepSource) {
+      // Original keeps its histogram, display gets a copy
+      TH1F *histogram = (TH1F*) source->GetHistogram()->Clone();
+      histogram->SetDirectory(nullptr);
+      target->SetHistogram(histogram);
+      delete targetHistogram;
+    } else {
+      // Source is deleted or swapped back later. Histograms are swapped - target gets the painted one with current zoom,
+      // source deletes the old one or hands it back on the next move
+      target->SetHistogram(source->GetHistogram());
+      source->SetHistogram(targetHistogram);
+    }
+    sourceFunctions = source->GetListOfFunctions();
+    targetFunctions = target->GetListOfFunctions();
+  } else if (from->InheritsFrom(TH1::Class()) && to->InheritsFrom(TH1::Class())) {
+    // Binning differs - copy axis attributes and translate zoom via user coordinates
+    TH1 *source = (TH1*) from;
+    TH1 *target = (TH1*) to;
+    TAxis *sourceAxes[] = { source->GetXaxis(), source->GetYaxis(), source->GetZaxis() };
+    TAxis *targetAxes[] = { target->GetXaxis(), target->GetYaxis(), target->GetZaxis() };
+    for (Int_t i = 0; i < 3; i++) {
+      TAxis *sourceAxis = sourceAxes[i];
+      TAxis *targetAxis = targetAxes[i];
+      sourceAxis->TAttAxis::Copy(*targetAxis);
+      targetAxis->SetTitle(sourceAxis->GetTitle());
+      targetAxis->CenterTitle(sourceAxis->GetCenterTitle());
+      targetAxis->SetTimeDisplay(sourceAxis->GetTimeDisplay());
+      targetAxis->SetTimeFormat(sourceAxis->GetTimeFormat());
+      if (i < source->GetDimension() && sourceAxis->TestBit(TAxis::kAxisRange))
+        targetAxis->SetRangeUser(sourceAxis->GetBinLowEdge(sourceAxis->GetFirst()), sourceAxis->GetBinUpEdge(sourceAxis->GetLast()));
+      else if (i < source->GetDimension())
+        targetAxis->SetRange(0, 0);
+    }
+    sourceFunctions = source->GetListOfFunctions();
+    targetFunctions = target->GetListOfFunctions();
+  }
+
+  while (sourceFunctions && targetFunctions && sourceFunctions->FirstLink()) {
+    TObjLink *lnk = sourceFunctions->FirstLink();
+    TObject *function = lnk->GetObject();
+    if (function->InheritsFrom(TPaveStats::Class()))
+      ((TPaveStats*) function)->SetParent(to);
+    targetFunctions->Add(function, lnk->GetOption());
+    sourceFunctions->Remove(lnk);
+  }
+}
+
+UInt_t CanvasHelper::updateDisplayObjects(TCanvas *canvas, const PadIndex &padIndex, Bool_t graphs, Bool_t histograms) {
+  UInt_t changed = 0;
+  for (auto const &node : padIndex.nodes) {
+    TVirtualPad *pad = node.first;
+    DisplayRange range = getDisplayRange(pad);
+    ULong64_t rangeKey = getDisplayRangeKey(range);
+    Bool_t hasDisplays = kFALSE;
+    UInt_t padChanged = 0;
+    // Pad marked modified by the caller - objects may have been edited in place, cached displays are not trusted
+    Bool_t padModified = pad->IsModified();
+
+    std::function<void(TList*, Bool_t)> visit = [&](TList *list, Bool_t inPrimitives) {
+      for (TObjLink *lnk = list->FirstLink(); lnk; lnk = lnk->Next()) {
+        TObject *object = lnk->GetObject();
+        if (inPrimitives && object->IsA() == TMultiGraph::Class()) {
+          TList *graphs = ((TMultiGraph*) object)->GetListOfGraphs();
+          if (graphs)
+            visit(graphs, kFALSE);
+          continue;
+        }
+        auto swap = displaySwaps.find(object);
+        TObject *original = swap != displaySwaps.end() ? swap->second.original : object;
+        Bool_t enabled = original->IsA() == TGraph::Class() ? graphs : (histograms && isRebinnableHistogram(original));
+        if (!enabled) {
+          if (swap != displaySwaps.end()) {
+            restoreDisplayObject(object);
+            padChanged++;
+          }
+          continue;
+        }
+        ULong64_t key = getDisplayKey(original, rangeKey);
+        if (swap != displaySwaps.end() && swap->second.key == key && !padModified) {
+          hasDisplays = kTRUE;
+          continue;
+        }
+
+        TObject *display = createDisplayObject(original, range);
+        if (!display) {
+          if (swap != displaySwaps.end()) {
+            restoreDisplayObject(object);
+            padChanged++;
+          }
+          continue;
+        }
+        padChanged++;
+
+        // Display is always owned by the list it is put in. Original is owned by us only if the list owned it
+        DisplaySwap displaySwap = { canvas, pad, list, original, key, inPrimitives,
+                                    inPrimitives ? original->TestBit(kCanDelete) : kTRUE };
+        if (swap != displaySwaps.end()) {
+          displaySwap.ownsOriginal = swap->second.ownsOriginal;
+          displaySwaps.erase(swap);
+        }
+        moveDisplayState(object, display, object == original);
+        display->SetBit(kCanDelete);
+        display->SetBit(kMustCleanup);
+        original->SetBit(kMustCleanup);
+        lnk->SetObject(display);
+        displaySwaps[display] = displaySwap;
+        displayOfOriginal[original] = display;
+        hasDisplays = kTRUE;
+        if (object != original)
+          delete object;
+      }
+    };
+    visit(pad->GetListOfPrimitives(), kTRUE);
+
+    if (hasDisplays)
+      displayPads[pad] = { canvas, rangeKey };
+    else
+      displayPads.erase(pad);
+    if (padChanged > 0)
+      pad->Modified();
+    changed += padChanged;
+  }
+  return changed;
+}
+
+void CanvasHelper::restoreDisplayObject(TObject *display) {
+  auto swap = displaySwaps.find(display);
+  if (swap == displaySwaps.end())
+    return;
+  DisplaySwap displaySwap = swap->second;
+  displaySwaps.erase(swap);
+  displayOfOriginal.erase(displaySwap.original);
+
+  // Put original back into the very same link - draw option and order of primitives are kept
+  for (TObjLink *lnk = displaySwap.list->FirstLink(); lnk; lnk = lnk->Next()) {
+    if (lnk->GetObject() == display) {
+      lnk->SetObject(displaySwap.original);
+      break;
+    }
+  }
+  moveDisplayState(display, displaySwap.original);
+  displaySwap.pad->Modified();
+  delete display;
+}
+
+UInt_t CanvasHelper::restoreDisplayObjects(TCanvas *canvas) {
+  std::vector<TObject*> displays;
+  for (auto const &swap : displaySwaps) {
+    if (swap.second.canvas == canvas)
+      displays.push_back(swap.first);
+  }
+  for (TObject *display : displays) {
+    restoreDisplayObject(display);
+  }
+  for (auto it = displayPads.begin(); it != displayPads.end();) {
+    it = it->second.canvas == canvas ? displayPads.erase(it) : std::next(it);
+  }
+  return displays.size();
+}
+
+void CanvasHelper::forgetDisplayObject(TObject *object) {
+  // Display deleted by the list that owns it - original goes with it if the list used to own the original
+  auto swap = displaySwaps.find(object);
+  if (swap != displaySwaps.end()) {
+    DisplaySwap displaySwap = swap->second;
+    displaySwaps.erase(swap);
+    displayOfOriginal.erase(displaySwap.original);
+    if (displaySwap.ownsOriginal)
+      delete displaySwap.original;
+    return;
+  }
+
+  // Original deleted while display is painted instead
+  auto original = displayOfOriginal.find(object);
+  if (original != displayOfOriginal.end()) {
+    TObject *display = original->second;
+    displayOfOriginal.erase(original);
+    auto displaySwap = displaySwaps.find(display);
+    if (displaySwap != displaySwaps.end()) {
+      TList *list = displaySwap->second.list;
+      displaySwaps.erase(displaySwap);
+      list->Remove(display);
+      delete display;
+    }
+    return;
+  }
+
+  // Pad deleted. Displays in pad primitives are deleted by the pad. A TMultiGraph may outlive the pad - give it its graphs back
+  auto displayPad = displayPads.find((TVirtualPad*) object);
+  if (displayPad != displayPads.end()) {
+    displayPads.erase(displayPad);
+    std::vector<TObject*> displays;
+    for (auto const &swap : displaySwaps) {
+      if (swap.second.pad == (TVirtualPad*) object && !swap.second.inPrimitives)
+        displays.push_back(swap.first);
+    }
+    for (TObject *display : displays) {
+      DisplaySwap &displaySwap = displaySwaps[display];
+      for (TObjLink *lnk = displaySwap.list->FirstLink(); lnk; lnk = lnk->Next()) {
+        if (lnk->GetObject() == display) {
+          lnk->SetObject(displaySwap.original);
+          break;
+        }
+      }
+      moveDisplayState(display, displaySwap.original);
+      displayOfOriginal.erase(displaySwap.original);
+      displaySwaps.erase(display);
+      delete display;
+    }
+  }
+}
+
+std::vector<TObject*> CanvasHelper::hideDisplayObjects(TCanvas *canvas) {
+  // Files that store objects (not pictures) must contain full original data. Displays are only put aside - their
+  // records stay, showDisplayObjects() puts the very same objects back without any layout
+  std::vector<TObject*> displays;
+  for (auto const &swap : displaySwaps) {
+    if (swap.second.canvas != canvas)
+      continue;
+    for (TObjLink *lnk = swap.second.list->FirstLink(); lnk; lnk = lnk->Next()) {
+      if (lnk->GetObject() == swap.first) {
+        lnk->SetObject(swap.second.original);
+        moveDisplayState(swap.first, swap.second.original);
+        displays.push_back(swap.first);
+        break;
+      }
+    }
+  }
+  return displays;
+}
 
-  Double_t y2 = 1 - pxToNdcVertical(MARGIN_TOP / 2 + (padHasTitle ? TITLE_VSPACE : 0), pad);
-  Double_t y1 = 1 - pxToNdcVertical(MARGIN_TOP / 2 + (padHasTitle ? TITLE_VSPACE : 0) + SUBTITLE_VSPACE, pad);
-  return std::make_pair(y1, y2);
+void CanvasHelper::showDisplayObjects(const std::vector<TObject*> &displays) {
+  for (TObject *display : displays) {
+    auto swap = displaySwaps.find(display);
+    if (swap == displaySwaps.end())
+      continue;
+    for (TObjLink *lnk = swap->second.list->FirstLink(); lnk; lnk = lnk->Next()) {
+      if (lnk->GetObject() == swap->second.original) {
+        lnk->SetObject(display);
+        moveDisplayState(swap->second.original, display);
+        break;
+      }
+    }
+  }
 }
 
-void CanvasHelper::addSubtitle(TVirtualPad *pad, const char *text) {
-  std::pair<Double_t, Double_t> subtitleYCoords = getSubtitleYNDCCoordinates(pad);
-  TPaveText *subtitle = new TPaveText(0, subtitleYCoords.first, 1, subtitleYCoords.second, "NBNDC"); // ndc coordinates
-  subtitle->SetTextAlign(kHAlignCenter + kVAlignCenter);
-  subtitle->SetName("subtitle");
-  subtitle->SetFillStyle(kFEmpty);
-  subtitle->SetLineWidth(0);
-  subtitle->SetTextFont(getFont());
-  subtitle->SetTextSize(FONT_SIZE_NORMAL);
-  subtitle->SetTextColor(kGray + 2);
-  subtitle->SetFillStyle(kFEmpty);
-  subtitle->SetLineWidth(0);
-  subtitle->AddText(text);
+UInt_t CanvasHelper::processCanvas(TCanvas *canvas) {
+  // Settings changed before the first layout of a lazy canvas are picked up by that layout
+  auto entry = registeredCanvases.find(canvas);
+  if (entry != registeredCanvases.end() && entry->second.layoutPending)
+    return 0;
+  std::vector<CanvasPass> passes(1);
+  passes[0].canvas = canvas;
+  runLayoutPasses(passes);
+  return passes[0].skippedPads;
+}
 
-  pad->cd();
-  subtitle->Draw();
+void CanvasHelper::processCanvases(const std::vector<TCanvas*> &canvases) {
+  std::vector<CanvasPass> passes;
+  passes.reserve(canvases.size());
+  for (TCanvas *canvas : canvases) {
+    if (!isCanvasRegistered(canvas))
+      continue;
+    // Lazy canvas gets its first paint and layout here, nothing left for the batch
+    if (runPendingLayout(canvas))
+      continue;
+    passes.emplace_back();
+    passes.back().canvas = canvas;
+  }
+  runLayoutPasses(passes);
+}
 
-  // pad->GetListOfPrimitives()->Add(subtitle);        // attach subtitle to pad primitives otherwise alignment wont work
-  // pad->Update();
+void CanvasHelper::runLayoutPasses(std::vector<CanvasPass> &passes) {
+  // Read pads of all canvases, compute all layouts at once, then write pads back canvas by canvas
+  std::vector<Layout::PadInput> inputs;
+  for (CanvasPass &pass : passes) {
+    collectCanvasPass(pass, inputs);
+  }
 
-  // subtitle->Print();
+  auto computeStart = std::chrono::steady_clock::now();
+  std::vector<PadGeometry> geometries;
+  Layout::computePads(inputs, geometries);
+  Double_t computeMs = std::chrono::duration<Double_t, std::milli>(std::chrono::steady_clock::now() - computeStart).count();
 
-  // Tweak top margin
-  setPadMargins(pad);
+  for (CanvasPass &pass : passes) {
+    pass.elapsedMs += computeMs;
+    applyCanvasPass(pass, geometries);
+  }
 }
 
-void CanvasHelper::onCanvasResized() {
-  // Every Pad will emit this signal. Supposedly child canvas pads as well.
-  // We need to listen to only parent canvas signal to eliminate doing things multiple times
-  for (auto const &entry : registeredCanvases) {
-    // Pop canvas if not existing anymore
-    // if (entry.first == nullptr){
-    //   registeredCanvases.erase( nullptr );
-    //   continue;
-    // }
-    UInt_t currentWidth = entry.first->GetWw();
-    UInt_t currentHeight = entry.first->GetWh();
-    UInt_t oldWidth = entry.second.first;
-    UInt_t oldHeight = entry.second.second;
-    if (currentWidth != oldWidth || currentHeight != oldHeight) {
-      processCanvas(entry.first);
-      registeredCanvases[entry.first] = { currentWidth, currentHeight };
+void CanvasHelper::collectCanvasPass(CanvasPass &pass, std::vector<Layout::PadInput> &inputs) {
+  TCanvas *canvas = pass.canvas;
+  CH_LOG(kLogLayout, kLogInfo, "Processing canvas \"" << canvas->GetName() << "\"");
+  auto passStart = std::chrono::steady_clock::now();
+
+  // Structure is only re-indexed when pads were added or removed
+  const PadIndex &padIndex = getPadIndex(canvas);
+
+  // If canvas has multi-title added, align child canvas with sub-pads
+  ULong64_t writesBefore = attributeWrites;
+  alignChildPad(canvas);
+  pass.attributesWritten += attributeWrites - writesBefore;
+
+  // Pads with the same fingerprint as after their last layout are skipped. Fingerprints of deleted pads are dropped
+  auto entry = registeredCanvases.find(canvas);
+
+  // Collect costs into the canvas report. Static layout functions access it via activeReport
+  Bool_t profiled = layoutProfiling && entry != registeredCanvases.end();
+  if (profiled)
+    entry->second.report = LayoutReport();
+  ActiveReportScope reportScope(profiled ? &entry->second.report : nullptr);
+
+  // Large objects are swapped for display copies first - layout is applied to what is actually painted
+  if (entry != registeredCanvases.end() && (entry->second.graphDecimation || entry->second.histogramRebinning))
+    pass.displaysChanged = updateDisplayObjects(canvas, padIndex, entry->second.graphDecimation, entry->second.histogramRebinning);
+  else if (!displaySwaps.empty())
+    pass.displaysChanged = restoreDisplayObjects(canvas);
+
+  // Find child pads. If canvas has multi title they belong to the container pad
+  std::vector<PadModel> models;
+  models.reserve(padIndex.layoutPads.size() + 1);
+  for (TVirtualPad *subPad : padIndex.layoutPads) {
+    subPad->SetFillStyle(EFillStyle::kFEmpty);
+    models.push_back(buildPadModel(subPad));
+  }
+  Bool_t live = entry != registeredCanvases.end() && entry->second.liveMode;
+  // Live pads keep their label bucket. Pads deleted since the last pass are dropped
+  std::unordered_map<TVirtualPad*, LivePad> livePads;
+  if (live) {
+    entry->second.pendingLivePads.clear();
+    for (PadModel &model : models) {
+      LivePad &state = livePads[model.pad] = entry->second.livePads[model.pad];
+      applyLiveLabelWidth(state, model);
+    }
+  }
+  if (gridColumnAlignment)
+    alignColumnLabelWidths(models, padIndex);
+  if (entry != registeredCanvases.end() && entry->second.sharedAxes != 0)
+    applySharedAxes(models, padIndex, entry->second.sharedAxes);
+
+  // Canvas itself is laid out last because it may contain title and subtitle
+  models.push_back(buildPadModel(canvas));
+  if (live) {
+    LivePad &state = livePads[canvas] = entry->second.livePads[canvas];
+    applyLiveLabelWidth(state, models.back());
+    entry->second.livePads.swap(livePads);
+  }
+
+  pass.firstInput = inputs.size();
+  // Distinct shapes are only counted for the layout report
+  std::set<Layout::ShapeKey> shapes;
+  for (const PadModel &model : models) {
+    ULong64_t fingerprint = getPadFingerprint(model);
+    if (entry != registeredCanvases.end()) {
+      auto old = entry->second.padFingerprints.find(model.pad);
+      if (old != entry->second.padFingerprints.end() && old->second == fingerprint) {
+        pass.fingerprints[model.pad] = fingerprint;
+        pass.skippedPads++;
+        continue;
+      }
     }
+    pass.styleWrites.push_back(stylePaves(model));
+    inputs.push_back(getLayoutInput(model));
+    if (activeReport)
+      shapes.insert(Layout::getShapeKey(inputs.back()));
+    pass.models.push_back(model);
   }
+  pass.layoutClasses = shapes.size();
+  pass.elapsedMs = std::chrono::duration<Double_t, std::milli>(std::chrono::steady_clock::now() - passStart).count();
 }
 
-void CanvasHelper::processCanvas(TCanvas *canvas) {
-  // Process canvas itself
-  // std::cout << "Processing canvas \"" << canvas->GetName() << "\"" << std::endl;
+void CanvasHelper::applyCanvasPass(CanvasPass &pass, const std::vector<PadGeometry> &geometries) {
+  TCanvas *canvas = pass.canvas;
+  auto applyStart = std::chrono::steady_clock::now();
+  auto entry = registeredCanvases.find(canvas);
+  ActiveReportScope reportScope(layoutProfiling && entry != registeredCanvases.end() ? &entry->second.report : nullptr);
+
+  for (size_t i = 0; i < pass.models.size(); i++) {
+    const PadModel &model = pass.models[i];
+    pass.attributesWritten += processPad(model, geometries[pass.firstInput + i], pass.styleWrites[i]);
+    if (activeReport) activeReport->padsProcessed++;
+    // Remember state after layout - this is what the next pass is compared against. Keep per-pass decisions
+    PadModel after = buildPadModel(model.pad);
+    after.yAxisMaxLabelWidthPx = model.yAxisMaxLabelWidthPx;
+    after.hideXAxis = model.hideXAxis;
+    after.hideYAxis = model.hideYAxis;
+    pass.fingerprints[model.pad] = getPadFingerprint(after);
+  }
 
-  // If canvas has multi-title added, align child canvas with sub-pads
-  alignChildPad(canvas);
+  if (entry != registeredCanvases.end()) {
+    entry->second.padFingerprints.swap(pass.fingerprints);
+    entry->second.skippedPads = pass.skippedPads;
+    entry->second.attributesWritten = pass.attributesWritten;
+  }
+  // Single repaint of everything modified above - laid out pads, replaced display objects, pads marked by the caller
+  if (pass.attributesWritten > 0 || pass.displaysChanged > 0 || canvas->IsModified()) {
+    PhaseTimer timer(kPhaseUpdate);
+    canvas->Update();
+  }
+  CH_LOG(kLogLayout, kLogInfo, "Canvas \"" << canvas->GetName() << "\" done, " << pass.skippedPads << " unchanged pads skipped");
+  if (activeReport) {
+    activeReport->padsSkipped = pass.skippedPads;
+    activeReport->layoutClasses = pass.layoutClasses;
+    activeReport->attributesWritten = pass.attributesWritten;
+    activeReport->totalMs = pass.elapsedMs
+        + std::chrono::duration<Double_t, std::milli>(std::chrono::steady_clock::now() - applyStart).count();
+  }
+}
 
-  // Get number of child pads
-//  UInt_t nSubPads = 0;
-//  for (Int_t i = 1;; i++) {
-//    TVirtualPad *subPad = canvas->GetPad(i);
-//    // We are looking up pads via name not getPad() because getPad() may also give us "_child" pad produces via AddMultiTitle()
-//    // TVirtualPad *childPad = canvas->GetPad(1);
-//    if (subPad) {
-//      // std::cout << "  Found child pad \"" << childPad->GetName() << "\". Processing..." << std::endl;
-//      nSubPads = i;
-//    } else {
-//      break;
-//    }
-//  }
+void CanvasHelper::hashPlotRange(ULong64_t &hash, TObject *plot) {
+  if (!plot)
+    return;
+  // Stored state only - scanning bins or points here would make the unchanged pad check as slow as the data is large
+  if (plot->InheritsFrom(TH1::Class())) {
+    TH1 *hist = (TH1*) plot;
+    hashValue(hash, hist->GetNcells());
+    hashValue(hash, hist->GetEntries());
+    hashValue(hash, hist->GetMaximumStored());
+    hashValue(hash, hist->GetMinimumStored());
+    hashValue(hash, hist->GetXaxis()->GetFirst());
+    hashValue(hash, hist->GetXaxis()->GetLast());
+    hashValue(hash, hist->GetYaxis()->GetFirst());
+    hashValue(hash, hist->GetYaxis()->GetLast());
+  } else if (plot->InheritsFrom(THStack::Class())) {
+    THStack *stack = (THStack*) plot;
+    hashValue(hash, stack->GetMaximum());
+    hashValue(hash, stack->GetMinimum());
+  } else if (plot->InheritsFrom(TGraph::Class())) {
+    // Same cheap state as the display cache. Axis limits of the graph histogram follow the data once it is painted
+    TGraph *graph = (TGraph*) plot;
+    hashGraphState(hash, graph);
+    TH1F *histogram = graph->GetHistogram();
+    if (histogram) {
+      hashValue(hash, histogram->GetXaxis()->GetXmin());
+      hashValue(hash, histogram->GetXaxis()->GetXmax());
+      hashValue(hash, histogram->GetMinimumStored());
+      hashValue(hash, histogram->GetMaximumStored());
+    }
+  } else if (plot->InheritsFrom(TMultiGraph::Class())) {
+    TMultiGraph *mgraph = (TMultiGraph*) plot;
+    TList *graphs = mgraph->GetListOfGraphs();
+    if (graphs) {
+      for (TObject *object : *graphs) {
+        hashPlotRange(hash, object);
+      }
+    }
+  } else if (plot->InheritsFrom(TF1::Class())) {
+    // Extremes of a function need minimization - parameters and range change whenever they do
+    TF1 *func = (TF1*) plot;
+    hashValue(hash, func->GetXmin());
+    hashValue(hash, func->GetXmax());
+    for (Int_t i = 0; i < func->GetNpar(); i++) {
+      hashValue(hash, func->GetParameter(i));
+    }
+  }
+}
 
-  // Find and process child pads
-  for (Int_t i = 1;; i++) {
-    // Check if canvas has multui title and account on it
-    TPad* c = (canvas->GetPad(-1) != nullptr) ? (TPad*)canvas->GetPad(-1) : canvas;
-
-    // If canvas has multi title then his sub pads dont belong to it, but to the "child" pad
-    TVirtualPad *subPad = c->GetPad(i);
-    if (subPad) {
-      subPad->SetFillStyle(EFillStyle::kFEmpty);
-      processPad(subPad);
-    } else {
-      break;
+ULong64_t CanvasHelper::getPadFingerprint(const PadModel &model) {
+  TVirtualPad *pad = model.pad;
+  ULong64_t hash = 14695981039346656037ULL;
+
+  // Pad pixel size and axis ranges
+  hashValue(hash, model.widthPx);
+  hashValue(hash, model.heightPx);
+  hashValue(hash, model.isChild);
+  hashValue(hash, model.yAxisMaxLabelWidthPx);
+  hashValue(hash, model.hideXAxis);
+  hashValue(hash, model.hideYAxis);
+  hashValue(hash, pad->GetLogx());
+  hashValue(hash, pad->GetLogy());
+  hashValue(hash, pad->GetUxmin());
+  hashValue(hash, pad->GetUxmax());
+  hashValue(hash, pad->GetUymin());
+  hashValue(hash, pad->GetUymax());
+  // Painted range above only changes on paint - plotted object may have been refilled since
+  hashPlotRange(hash, model.plot);
+
+  // Titles
+  if (model.xAxis) hashString(hash, model.xAxis->GetTitle());
+  if (model.yAxis) hashString(hash, model.yAxis->GetTitle());
+  for (TObject *object : { model.title, model.subtitle }) {
+    hashValue(hash, object != nullptr);
+    if (object && object->InheritsFrom(TPaveText::Class())) {
+      for (TObject *line : *(((TPaveText*) object)->GetListOfLines())) {
+        hashString(hash, line->GetTitle());
+      }
     }
   }
 
-  // Update pad itself only if it has no child pads - wrong
-//    if (nChildPads == 0){
-//        std::cout << "  No child pads. Processing Canvas itself..." << std::endl;
-//        processPad(canvas);
-//    } else {
-//        std::cout << "  Found " << nChildPads << " child pads. Not processing main canvas." << std::endl;
-//    }
+  // Pave contents and alignment
+  hashValue(hash, model.paves.size());
+  for (TPave *pave : model.paves) {
+    hashValue(hash, pave->TestBits(kPaveAlignLeft | kPaveAlignRight | kPaveAlignTop | kPaveAlignBottom));
+    if (pave->InheritsFrom(TPaveText::Class())) {
+      for (TObject *line : *(((TPaveText*) pave)->GetListOfLines())) {
+        hashString(hash, line->GetTitle());
+      }
+    } else if (pave->InheritsFrom(TLegend::Class())) {
+      TLegend *legend = (TLegend*) pave;
+      hashValue(hash, legend->GetNColumns());
+      for (TObject *object : *(legend->GetListOfPrimitives())) {
+        if (object->InheritsFrom(TLegendEntry::Class()))
+          hashString(hash, ((TLegendEntry*) object)->GetLabel());
+      }
+    }
+  }
+  hashValue(hash, model.frame != nullptr);
+  return hash;
+}
+
+Layout::PadInput CanvasHelper::getLayoutInput(const PadModel &model, Bool_t measurePaves) {
+  Layout::PadInput input;
+  input.widthPx = model.widthPx;
+  input.heightPx = model.heightPx;
+  input.isChild = model.isChild;
+  input.hasTitle = model.title != nullptr;
+  input.hasSubtitle = model.subtitle != nullptr;
+  input.hasXAxisTitle = hasXAxisTitle(model);
+  input.hasYAxisTitle = hasYAxisTitle(model);
+  input.hideXAxis = model.hideXAxis;
+  input.hideYAxis = model.hideYAxis;
+  input.yAxisMaxLabelWidthPx = model.yAxisMaxLabelWidthPx;
+  input.theme = *model.theme;
+  if (!measurePaves)
+    return input;
+
+  // Estimate pave sizes. Text measurement uses TTF - this part always runs serially
+  PhaseTimer timer(kPhaseAlignAllPaves);
+  input.paves.reserve(model.paves.size());
+  for (TPave *pave : model.paves) {
+    Layout::PaveInput paveInput = { 300, 100, pave->TestBits(kPaveAlignLeft | kPaveAlignRight | kPaveAlignTop | kPaveAlignBottom) };
+    if (pave->InheritsFrom(TPaveText::Class())) {
+      paveInput.widthPx = (Int_t) getPaveTextWidthPx((TPaveText*) pave, *model.theme);
+      paveInput.heightPx = getPaveLines(pave) * model.theme->paveLineVSpace;
+    } else if (pave->InheritsFrom(TLegend::Class())) {
+      TLegend *legend = (TLegend*) pave;
+      paveInput.widthPx = (Int_t) getLegendWidthPx(legend, *model.theme) * legend->GetNColumns();
+      paveInput.heightPx = legend->GetNRows() * model.theme->paveLineVSpace;
+    }
+    input.paves.push_back(paveInput);
+  }
+  return input;
+}
 
-  // Update Canvas itself because it may contain title and subtitle
-  processPad(canvas);
+CanvasHelper::PadLayout CanvasHelper::computePadLayout(const PadModel &model) {
+  return Layout::computePadLayout(getLayoutInput(model, kFALSE));
+}
 
-  // Check if this particular canvas needed to be saved
-//  TObjString* canvasFileName = (TObjString*)canvasesToBeExported->FindObject(canvas);
-//  if (canvasFileName != nullptr){
-//    // Save canvas
-//    doExportCanvas(canvas, canvasFileName->GetString().Data());
-//    // Pop canvas from saved
-//    canvasesToBeExported->Remove(canvas);
-//  }
-  // gSystem->ProcessEvents();
-  // gStyle->Reset();
+void CanvasHelper::alignColumnLabelWidths(std::vector<PadModel> &models, const PadIndex &padIndex) {
+  // Widest y axis labels per grid column - frames of the column line up and pads share one layout
+  std::unordered_map<Int_t, Double_t> columnWidths;
+  for (const PadModel &model : models) {
+    auto node = padIndex.nodes.find(model.pad);
+    if (node == padIndex.nodes.end())
+      continue;
+    Double_t &width = columnWidths[node->second.column];
+    width = TMath::Max(width, model.yAxisMaxLabelWidthPx);
+  }
+  for (PadModel &model : models) {
+    auto node = padIndex.nodes.find(model.pad);
+    if (node != padIndex.nodes.end())
+      model.yAxisMaxLabelWidthPx = columnWidths[node->second.column];
+  }
+}
+
+void CanvasHelper::applySharedAxes(std::vector<PadModel> &models, const PadIndex &padIndex, UInt_t sharedAxes) {
+  // Bottom row per grid column and leftmost column per grid row
+  std::unordered_map<Int_t, Int_t> bottomRows, leftColumns;
+  for (const PadModel &model : models) {
+    auto node = padIndex.nodes.find(model.pad);
+    if (node == padIndex.nodes.end())
+      continue;
+    const PadNode &n = node->second;
+    auto bottom = bottomRows.emplace(n.column, n.row).first;
+    bottom->second = TMath::Max(bottom->second, n.row);
+    auto left = leftColumns.emplace(n.row, n.column).first;
+    left->second = TMath::Min(left->second, n.column);
+  }
+
+  // Requested axes only. In auto mode x axis is shared in columns where all pads have equal x ranges, y axis in such rows
+  Bool_t shareX = (sharedAxes & kSharedAxisX) == kSharedAxisX;
+  Bool_t shareY = (sharedAxes & kSharedAxisY) == kSharedAxisY;
+  Bool_t detect = (sharedAxes & kSharedAxesAuto) == kSharedAxesAuto;
+  std::unordered_map<Int_t, Bool_t> sameColumnX, sameRowY;
+  if (detect && (shareX || shareY)) {
+    auto sameRange = [](Double_t a1, Double_t a2, Double_t b1, Double_t b2) {
+      Double_t tolerance = 1E-9 * TMath::Max(std::abs(a2 - a1), std::abs(b2 - b1));
+      return std::abs(a1 - b1) <= tolerance && std::abs(a2 - b2) <= tolerance;
+    };
+    std::unordered_map<Int_t, TVirtualPad*> columnPads, rowPads;
+    for (const PadModel &model : models) {
+      auto node = padIndex.nodes.find(model.pad);
+      if (node == padIndex.nodes.end())
+        continue;
+      TVirtualPad *pad = model.pad;
+      TVirtualPad *columnPad = columnPads.emplace(node->second.column, pad).first->second;
+      TVirtualPad *rowPad = rowPads.emplace(node->second.row, pad).first->second;
+      Bool_t &sameX = sameColumnX.emplace(node->second.column, kTRUE).first->second;
+      Bool_t &sameY = sameRowY.emplace(node->second.row, kTRUE).first->second;
+      sameX = sameX && columnPad->GetLogx() == pad->GetLogx()
+          && sameRange(columnPad->GetUxmin(), columnPad->GetUxmax(), pad->GetUxmin(), pad->GetUxmax());
+      sameY = sameY && rowPad->GetLogy() == pad->GetLogy()
+          && sameRange(rowPad->GetUymin(), rowPad->GetUymax(), pad->GetUymin(), pad->GetUymax());
+    }
+  }
+
+  for (PadModel &model : models) {
+    auto node = padIndex.nodes.find(model.pad);
+    if (node == padIndex.nodes.end())
+      continue;
+    const PadNode &n = node->second;
+    model.hideXAxis = shareX && n.row < bottomRows[n.column] && (!detect || sameColumnX[n.column]);
+    model.hideYAxis = shareY && n.column > leftColumns[n.row] && (!detect || sameRowY[n.row]);
+    // Hidden labels take no space - lets hidden pads of a column share one layout
+    if (model.hideYAxis)
+      model.yAxisMaxLabelWidthPx = 0;
+  }
 }
 
-void CanvasHelper::processPad(TVirtualPad *pad) {
+UInt_t CanvasHelper::processPad(const PadModel &model, const PadGeometry &geometry, UInt_t styleWrites) {
+  TVirtualPad *pad = model.pad;
+  const PadLayout &layout = geometry.layout;
+  ULong64_t writesBefore = attributeWrites;
   // Remember default left margin - related to the fact that we cannot get TGaxis from canvas
 //  std::string padName = pad->GetName();
 //  if (defaultPadLeftMargins.find(padName) == defaultPadLeftMargins.end()){
@@ -529,39 +2573,55 @@ void CanvasHelper::processPad(TVirtualPad *pad) {
   // We are simply tweaking the sizes, distances and objects.
 
   // Tweak axis and add custom axis titles that don't move around when scaling
-  std::pair<TAxis*, TAxis*> axis = getPadXYAxis(pad);
-  convertAxisToPxSize(axis.first, 'x', pad);
-  convertAxisToPxSize(axis.second, 'y', pad);
+  {
+    PhaseTimer timer(kPhaseConvertAxis);
+    convertAxisToPxSize(model.xAxis, 'x', model, layout);
+    convertAxisToPxSize(model.yAxis, 'y', model, layout);
+  }
   // alignAxisTitles(pad);
 
-  alignTitle(pad);
-  alignSubtitle(pad);
-  alignAllPaves(pad);
-  setPadMargins(pad);
-  setPadCustomFrameBorder(pad); // should go after setPadMargins();
-  setPadNDivisions(pad);
+  {
+    PhaseTimer timer(kPhaseAlignTitle);
+    alignTitle(model, geometry);
+    alignSubtitle(model, geometry);
+  }
+  {
+    PhaseTimer timer(kPhaseAlignAllPaves);
+    alignAllPaves(model, geometry);
+  }
+  {
+    PhaseTimer timer(kPhaseSetPadMargins);
+    setPadMargins(model, layout);
+  }
+  {
+    PhaseTimer timer(kPhaseSetPadCustomFrameBorder);
+    setPadCustomFrameBorder(model); // should go after setPadMargins();
+  }
+  {
+    PhaseTimer timer(kPhaseSetPadNDivisions);
+    setPadNDivisions(model, layout);
+  }
 
+  // Nothing differs from what is painted already - repaint (and resend to web canvas) is not needed
+  // Pad is only marked here. Caller updates the whole canvas once, after all pads are laid out
+  UInt_t writes = styleWrites + (attributeWrites - writesBefore);
+  if (writes == 0)
+    return 0;
+  if (activeReport) activeReport->padsRepainted++;
   pad->Modified();
-  pad->Update();
+  return writes;
 }
 
-void CanvasHelper::alignAllPaves(TVirtualPad *pad) {
-  TList *primitives = pad->GetListOfPrimitives();
-  for (TObject *object : *primitives) {
-    if (!object->InheritsFrom(TPave::Class()))
-      continue;
-    TPave *pave = (TPave*) object;
-
-    // Do not process title, subtitle and axis titles
-    TString paveName = pave->GetName();
-    if (paveName.Contains("title"))
-      continue;
-
+UInt_t CanvasHelper::stylePaves(const PadModel &model) {
+  // Font and rounded values change pave sizes - done before paves are measured
+  PhaseTimer timer(kPhaseAlignAllPaves);
+  ULong64_t writesBefore = attributeWrites;
+  for (TPave *pave : model.paves) {
     // Adjust font size
     if (pave->InheritsFrom(TPaveText::Class())) {
       TPaveText *paveText = (TPaveText*) pave;
-      paveText->SetTextFont(getFont());
-      paveText->SetTextSize(FONT_SIZE_NORMAL);
+      CH_SET(paveText, TextFont, getFont());
+      CH_SET(paveText, TextSize, model.theme->fontSizeNormal);
     } else if (pave->InheritsFrom(TLegend::Class())) {
       TLegend *legend = (TLegend*) pave;
 //      legend->SetTextFont(getFont());
@@ -570,83 +2630,40 @@ void CanvasHelper::alignAllPaves(TVirtualPad *pad) {
         if (!obj->InheritsFrom(TLegendEntry::Class()))
           continue;
         TLegendEntry *entry = (TLegendEntry*) obj;
-        entry->SetTextFont(getFont());
-        entry->SetTextSize(FONT_SIZE_NORMAL);
+        CH_SET(entry, TextFont, getFont());
+        CH_SET(entry, TextSize, model.theme->fontSizeNormal);
       }
     }
 
     // Round stat value/errors
     if (pave->InheritsFrom(TPaveText::Class())) {
       TPaveText *paveText = (TPaveText*) pave;
-      Round::paveTextValueErrors(paveText);
-    }
-
-    // Estimate pave width
-    Double_t paveWidthPx = 300;
-    if (pave->InheritsFrom(TPaveText::Class())) {
-      TPaveText *paveText = (TPaveText*) pave;
-      paveWidthPx = (Int_t) getPaveTextWidthPx(paveText);
-    } else if (pave->InheritsFrom(TLegend::Class())) {
-      TLegend *legend = (TLegend*) pave;
-      paveWidthPx = (Int_t) getLegendWidthPx(legend);
-      paveWidthPx = paveWidthPx * legend->GetNColumns();
-    }
-
-    if (pave->TestBit(kPaveAlignLeft)) {
-      Int_t leftMargin = getFrameLeftMarginPx(pad);
-      pave->SetX1NDC(pxToNdcHorizontal(leftMargin - 1, pad));  // -1 accounts on pixel perfect alignment (replace with border?)
-      pave->SetX2NDC(pxToNdcHorizontal(leftMargin + paveWidthPx, pad));
-    }
-    if (pave->TestBit(kPaveAlignRight)) {
-      Int_t rightMargin = getFrameRightMarginPx();
-      pave->SetX2NDC(1 - pxToNdcHorizontal(rightMargin, pad));
-      pave->SetX1NDC(1 - pxToNdcHorizontal(rightMargin + paveWidthPx, pad));
-    }
-
-    // Calculate and align height
-    Int_t paveHeightPx = 100;
-    if (pave->InheritsFrom(TPaveText::Class())) {
-      TPaveText *paveText = (TPaveText*) pave;
-      paveHeightPx = getPaveLines(pave) * PAVELINE_VSPACE;
-    } else if (pave->InheritsFrom(TLegend::Class())) {
-      TLegend *legend = (TLegend*) pave;
-      paveHeightPx = legend->GetNRows() * PAVELINE_VSPACE;
-    }
-
-    if (pave->TestBit(kPaveAlignTop)) {
-      Int_t topMargin = getFrameTopMarginPx(pad);
-      pave->SetY2NDC(1 - pxToNdcVertical(topMargin - 1, pad));
-      pave->SetY1NDC(1 - pxToNdcVertical(topMargin + paveHeightPx, pad));
-    }
-    if (pave->TestBit(kPaveAlignBottom)) {
-      Int_t bottomMargin = getFrameBottomMarginPx(pad);
-      pave->SetY1NDC(pxToNdcVertical(bottomMargin, pad));
-      pave->SetY2NDC(pxToNdcVertical(bottomMargin + paveHeightPx, pad));
+      attributeWrites += Round::paveTextValueErrors(paveText);
     }
   }
+  return attributeWrites - writesBefore;
 }
 
-Int_t CanvasHelper::getFrameLeftMarginPx(TVirtualPad *pad) {
-  Int_t leftMargin = MARGIN_LEFT;
-  // Add y axis title offset
-  if (hasYAxisTitle(pad)) {
-    leftMargin += AXISTITLE_VSPACE;
+void CanvasHelper::alignAllPaves(const PadModel &model, const PadGeometry &geometry) {
+  for (size_t i = 0; i < model.paves.size() && i < geometry.paves.size(); i++) {
+    TPave *pave = model.paves[i];
+    const Layout::Box &box = geometry.paves[i];
+    if (pave->TestBit(kPaveAlignLeft) || pave->TestBit(kPaveAlignRight)) {
+      CH_SET(pave, X1NDC, box.x1);
+      CH_SET(pave, X2NDC, box.x2);
+    }
+    if (pave->TestBit(kPaveAlignTop) || pave->TestBit(kPaveAlignBottom)) {
+      CH_SET(pave, Y1NDC, box.y1);
+      CH_SET(pave, Y2NDC, box.y2);
+    }
   }
-
-  // Add y axis label width
-  Double_t labelWidth = getYAxisMaxLabelWidthPx(pad);
-  leftMargin += labelWidth;
-
-  // Add y axis label offset
-  leftMargin += AXIS_LABEL_OFFSET;
-  return leftMargin;
 }
 
-Bool_t CanvasHelper::hasXAxisTitle(TVirtualPad *pad) {
+Bool_t CanvasHelper::hasXAxisTitle(const PadModel &model) {
 //    if (pad->GetPrimitive("xaxistitle") != nullptr)
 //        return true;
 
-  TAxis *xAxis = getPadXYAxis(pad).first;
+  TAxis *xAxis = model.xAxis;
   if (!xAxis)
     return false;
   if (strlen(xAxis->GetTitle()) > 0)
@@ -656,11 +2673,11 @@ Bool_t CanvasHelper::hasXAxisTitle(TVirtualPad *pad) {
 }
 
 // TODO: To be deleted and tested
-Bool_t CanvasHelper::hasYAxisTitle(TVirtualPad *pad) {
+Bool_t CanvasHelper::hasYAxisTitle(const PadModel &model) {
 //    if (pad->GetPrimitive("yaxistitle") != nullptr)
 //        return true;
 
-  TAxis *yAxis = getPadXYAxis(pad).second;
+  TAxis *yAxis = model.yAxis;
   if (!yAxis)
     return false;
   if (strlen(yAxis->GetTitle()) > 0)
@@ -669,120 +2686,78 @@ Bool_t CanvasHelper::hasYAxisTitle(TVirtualPad *pad) {
   return false;
 }
 
-Int_t CanvasHelper::getFrameRightMarginPx(/*TVirtualPad *pad*/) {
-  return MARGIN_RIGHT;
-}
-
-Int_t CanvasHelper::getFrameTopMarginPx(TVirtualPad *pad) {
-  Int_t topMargin = isChildPad(pad) ? MARGIN_TOP / 2 : MARGIN_TOP;
-  if (pad->GetPrimitive("title") != nullptr) {
-    topMargin += isChildPad(pad) ? TITLE_VSPACE * 3. / 4. : TITLE_VSPACE;
-  }
-  if (pad->GetPrimitive("subtitle") != nullptr) {
-    topMargin += SUBTITLE_VSPACE;
-  }
-//    if (pad->GetPrimitive("title") != nullptr || pad->GetPrimitive("subtitle") != nullptr) {
-//        topMargin += TITLE_VSPACE / 2;
-//    }
-
-  return topMargin;
-}
-
-Int_t CanvasHelper::getFrameBottomMarginPx(TVirtualPad *pad) {
-  Int_t bottomMargin = MARGIN_BOTTOM;
-  if (hasXAxisTitle(pad)) {
-    bottomMargin += AXISTITLE_VSPACE;
-  }
-
-  // Add x axis label height
-  bottomMargin += FONT_SIZE_NORMAL;
-
-  // Add x axis label offset
-  bottomMargin += AXIS_LABEL_OFFSET;
-
-  return bottomMargin;
-}
-
-void CanvasHelper::setPadMargins(TVirtualPad *pad) {
+void CanvasHelper::setPadMargins(const PadModel &model, const PadLayout &layout) {
+  TVirtualPad *pad = model.pad;
   // TFrame* frame = getPadFrame(pad);
 
   // Problem: child pads return Ww (width) and Wh (height) from parent's canvas object 🥵
-  // Solution: wrote custom functions to get actual size
-  // Double_t padWidth = getPadWidthPx(pad);
-  // Double_t padHeight = getPadHeightPx(pad);
-
-  Int_t leftMargin = getFrameLeftMarginPx(pad);
-  // gStyle->SetPadLeftMargin(pxToNdcHorizontal(leftMargin, pad));
-  pad->SetLeftMargin(pxToNdcHorizontal(leftMargin, pad));
-  // if (frame) frame->SetX1(pxToNdcHorizontal(leftMargin, pad));
-
-  Int_t topMargin = getFrameTopMarginPx(pad);
-  // gStyle->SetPadTopMargin(pxToNdcVertical(topMargin, pad));
-  pad->SetTopMargin(pxToNdcVertical(topMargin, pad));
-  // if (frame) frame->SetY2(pxToNdcVertical(1-topMargin, pad));
-
-  Int_t rightMargin = getFrameRightMarginPx();
-  // gStyle->SetPadRightMargin(pxToNdcHorizontal(rightMargin, pad));
-  pad->SetRightMargin(pxToNdcHorizontal(rightMargin, pad));
-  // if (frame) frame->SetX2(pxToNdcHorizontal(1-rightMargin, pad));
-
-  Int_t bottomMargin = getFrameBottomMarginPx(pad);
-  // gStyle->SetPadBottomMargin(pxToNdcVertical(bottomMargin, pad));
-  pad->SetBottomMargin(pxToNdcVertical(bottomMargin, pad));
-  // if (frame) frame->SetY2(pxToNdcVertical(bottomMargin, pad));
+  // Solution: wrote custom functions to get actual size, margins are converted to NDC in computePadLayout()
+  CH_SET(pad, LeftMargin, layout.marginNdc.left);
+  CH_SET(pad, TopMargin, layout.marginNdc.top);
+  CH_SET(pad, RightMargin, layout.marginNdc.right);
+  CH_SET(pad, BottomMargin, layout.marginNdc.bottom);
 }
 
 // Function prevents double border with left (and potentially bottom axis)
 // TODO: account on existing axis, add maybe left line if needed - rear case
-void CanvasHelper::setPadCustomFrameBorder(TVirtualPad *pad) {
-  TFrame* frame = (TFrame*)(pad->GetListOfPrimitives()->FindObject("TFrame"));
+void CanvasHelper::setPadCustomFrameBorder(const PadModel &model) {
+  TVirtualPad *pad = model.pad;
+  TFrame* frame = model.frame;
   if (!frame) return;
 
   // Remove pad frame background border
-  if (frame->GetFillStyle() != EFillStyle::kFEmpty) frame->SetFillStyle(EFillStyle::kFEmpty);
-  if (frame->GetLineWidth() != 0) frame->SetLineWidth(0);
+  CH_SET(frame, FillStyle, EFillStyle::kFEmpty);
+  CH_SET(frame, LineWidth, 0);
 
   // Draw or update custom frame made from two lines - top and right
   // Top line
-  if (pad->GetListOfPrimitives()->FindObject("frameTopLine") == nullptr){
+  if (model.frameTopLine == nullptr){
+    if (activeReport) activeReport->objectsAllocated++;
+    attributeWrites++;
     TNamedLine* l = new TNamedLine("frameTopLine", pad->GetLeftMargin(), 1-pad->GetTopMargin(), 1-pad->GetRightMargin(), 1-pad->GetTopMargin());
     l->SetNDC();
     pad->GetListOfPrimitives()->AddAfter(frame, l);
   } else {
-    TLine* l = (TLine*)(pad->GetListOfPrimitives()->FindObject("frameTopLine"));
-    l->SetX1(pad->GetLeftMargin());
-    l->SetY1(1-pad->GetTopMargin());
-    l->SetX2(1-pad->GetRightMargin());
-    l->SetY2(1 - pad->GetTopMargin());
+    TLine* l = model.frameTopLine;
+    CH_SET(l, X1, pad->GetLeftMargin());
+    CH_SET(l, Y1, 1-pad->GetTopMargin());
+    CH_SET(l, X2, 1-pad->GetRightMargin());
+    CH_SET(l, Y2, 1 - pad->GetTopMargin());
   }
   // Right Line
-  if (pad->GetListOfPrimitives()->FindObject("frameRightLine") == nullptr){
+  if (model.frameRightLine == nullptr){
+    if (activeReport) activeReport->objectsAllocated++;
+    attributeWrites++;
     TNamedLine* l = new TNamedLine("frameRightLine", 1-pad->GetRightMargin(), 1-pad->GetTopMargin(), 1-pad->GetRightMargin(), pad->GetBottomMargin());
     l->SetNDC();
     pad->GetListOfPrimitives()->AddAfter(frame, l);
   } else {
-    TLine* l = (TLine*)(pad->GetListOfPrimitives()->FindObject("frameRightLine"));
-    l->SetX1(1-pad->GetRightMargin());
-    l->SetY1(1-pad->GetTopMargin());
-    l->SetX2(1-pad->GetRightMargin());
-    l->SetY2(pad->GetBottomMargin());
+    TLine* l = model.frameRightLine;
+    CH_SET(l, X1, 1-pad->GetRightMargin());
+    CH_SET(l, Y1, 1-pad->GetTopMargin());
+    CH_SET(l, X2, 1-pad->GetRightMargin());
+    CH_SET(l, Y2, pad->GetBottomMargin());
   }
 
-  pad->GetListOfPrimitives()->Print();
+  if (CH_LOG_ENABLED(kLogLayout, kLogDebug)) {
+    CH_LOG(kLogLayout, kLogDebug, "Primitives of pad \"" << pad->GetName() << "\":");
+    pad->GetListOfPrimitives()->Print();
+  }
 }
 
-void CanvasHelper::setPadNDivisions(TVirtualPad *pad) {
-  std::pair<TAxis*, TAxis*> axis = getPadXYAxis(pad);
+void CanvasHelper::setPadNDivisions(const PadModel &model, const PadLayout &layout) {
+  std::pair<TAxis*, TAxis*> axis = std::make_pair(model.xAxis, model.yAxis);
 
   // For x axis
   if (axis.first) {
     // Get whatever minor divisions were originally (refer to documentation)
     Int_t nDivX = axis.first->GetNdivisions();
     Int_t nDivXMinor = nDivX / 100;
-    // Set one major division per 75 px
-    Int_t width = getPadWidthPx(pad);
-    Int_t nDivXMajor = width / 75;
-    axis.first->SetNdivisions(nDivXMajor, nDivXMinor, 0, kTRUE);
+    // Optimized divisions are stored as positive number (plus max digits in millions)
+    if (nDivX % 1000000 != layout.nDivXMajor + 100 * nDivXMinor) {
+      axis.first->SetNdivisions(layout.nDivXMajor, nDivXMinor, 0, kTRUE);
+      attributeWrites++;
+    }
   }
 
   // For y axis
@@ -790,10 +2765,10 @@ void CanvasHelper::setPadNDivisions(TVirtualPad *pad) {
     // Get whatever minor divisions were originally (refer to documentation)
     Int_t nDivY = axis.second->GetNdivisions();
     Int_t nDivYMinor = nDivY / 100;
-    // Set one major division per 50 px
-    Int_t height = getPadHeightPx(pad);
-    Int_t nDivYMajor = height / 50;
-    axis.second->SetNdivisions(nDivYMajor, nDivYMinor, 0, kTRUE);
+    if (nDivY % 1000000 != layout.nDivYMajor + 100 * nDivYMinor) {
+      axis.second->SetNdivisions(layout.nDivYMajor, nDivYMinor, 0, kTRUE);
+      attributeWrites++;
+    }
   }
 }
 
@@ -820,31 +2795,296 @@ void CanvasHelper::setPaveAlignment(TPave *pave, UInt_t align) {
   }
 }
 
-void CanvasHelper::saveCanvas(TCanvas *canvas, UInt_t format) {
+Bool_t CanvasHelper::saveCanvas(TCanvas *canvas, UInt_t format) {
+  if (canvas == nullptr) return kFALSE;
+
+  // Lazily registered canvas is laid out before its first save
+  if (fgInstance)
+    fgInstance->runPendingLayout(canvas);
+
+  // Bring layout and painting up to date once. Every format below reuses this state
+  canvas->Update();
+
   // Workaround for the thick lines on the multi-pad
   // https://root-forum.cern.ch/t/lines-in-the-pdf-file-are-way-too-thick/16510
   // Line scale should be proportional to the size of the default canvas
   Double_t canvasWidth = canvas->GetWw();
   Double_t defaultCanvasWidth = gStyle->GetCanvasDefW();
   Double_t ratio = canvasWidth/defaultCanvasWidth;
+  Float_t lineScalePS = gStyle->GetLineScalePS();
   gStyle->SetLineScalePS(3./ratio);
 
+  // Formats that do not share painted state with other formats
   TString fileName = canvas->GetName();
+  std::vector<TString> independentFiles;
+  if ((format & kFormatROOT) == kFormatROOT) {
+    independentFiles.push_back(fileName + ".root");
+  }
   if ((format & kFormatC) == kFormatC) {
-    canvas->SaveAs(fileName + ".c");
+    independentFiles.push_back(fileName + ".c");
   }
   if ((format & kFormatPng) == kFormatPng) {
-    canvas->SaveAs(fileName + ".png");
+    independentFiles.push_back(fileName + ".png");
   }
+
+  // Vector formats are painted in this process one after another with the same line scale
+  std::vector<TString> vectorFiles;
   if ((format & kFormatPs) == kFormatPs) {
-    canvas->SaveAs(fileName + ".ps");
+    vectorFiles.push_back(fileName + ".ps");
   }
-  if ((format & kFormatROOT) == kFormatROOT) {
-    canvas->SaveAs(fileName + ".root");
+  if ((format & kFormatPdf) == kFormatPdf) {
+    vectorFiles.push_back(fileName + ".pdf");
+  }
+
+  // SaveAs() only prints errors. Old file is removed first, so a missing or empty file means the write failed
+  auto saveFile = [canvas](const TString &file) {
+    gSystem->Unlink(file);
+    canvas->SaveAs(file);
+    FileStat_t stat;
+    if (gSystem->GetPathInfo(file, stat) == 0 && stat.fSize > 0)
+      return kTRUE;
+    CH_LOG(kLogExport, kLogError, "Could not write \"" << file << "\"");
+    return kFALSE;
+  };
+
+  // Object files (.root, .c) store original graphs instead of their decimated display copies
+  auto saveObjects = [canvas, &saveFile](const TString &file, Bool_t restoreDisplay) {
+    Bool_t isObjectFile = file.EndsWith(".root") || file.EndsWith(".c");
+    std::vector<TObject*> displays;
+    if (isObjectFile && fgInstance)
+      displays = fgInstance->hideDisplayObjects(canvas);
+    Bool_t saved = saveFile(file);
+    if (!displays.empty() && restoreDisplay)
+      fgInstance->showDisplayObjects(displays);
+    return saved;
+  };
+
+  Bool_t success = kTRUE;
+
+#ifndef _WIN32
+  // In batch mode independent formats are written concurrently by forked workers
+  std::vector<pid_t> workers;
+  Bool_t useFork = gROOT->IsBatch() && !isExportWorker && independentFiles.size() + vectorFiles.size() > 1;
+  for (const TString &file : independentFiles) {
+    if (useFork) {
+      std::cout.flush();
+      fflush(nullptr);
+      pid_t pid = fork();
+      if (pid == 0) {
+        Bool_t saved = saveObjects(file, kFALSE);
+        fflush(nullptr);
+        _exit(saved ? 0 : 1);
+      }
+      if (pid > 0) {
+        workers.push_back(pid);
+        continue;
+      }
+    }
+    success = saveObjects(file, kTRUE) && success;
+  }
+#else
+  for (const TString &file : independentFiles) {
+    success = saveObjects(file, kTRUE) && success;
+  }
+#endif
+
+  for (const TString &file : vectorFiles) {
+    success = saveFile(file) && success;
+  }
+  CH_LOG(kLogExport, kLogInfo, "Canvas \"" << fileName << "\" saved in " << independentFiles.size() + vectorFiles.size() << " formats");
+
+#ifndef _WIN32
+  for (pid_t pid : workers) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+      continue;
+    success = kFALSE;
+    if (WIFSIGNALED(status)) {
+      CH_LOG(kLogExport, kLogError, "Export worker of canvas \"" << fileName << "\" killed by signal " << WTERMSIG(status));
+    } else {
+      CH_LOG(kLogExport, kLogError, "Export worker of canvas \"" << fileName << "\" failed, code " << WEXITSTATUS(status));
+    }
+  }
+#endif
+
+  gStyle->SetLineScalePS(lineScalePS);
+  return success;
+}
+
+std::vector<CanvasHelper::ExportResult> CanvasHelper::saveCanvases(const std::vector<TCanvas*> &canvases, UInt_t format,
+    UInt_t nWorkers, std::function<void(const ExportResult&)> callback) {
+  auto getCanvas = [&canvases](UInt_t i) -> TCanvas* {
+    return canvases[i];
+  };
+  return saveCanvasesForked(canvases.size(), getCanvas, kFALSE, format, nWorkers, callback);
+}
+
+std::vector<CanvasHelper::ExportResult> CanvasHelper::saveCanvases(TFile *file, UInt_t format, UInt_t nWorkers,
+    std::function<void(const ExportResult&)> callback) {
+  if (file == nullptr || file->IsZombie())
+    return {};
+
+  // Collect canvas keys. Keys are sorted with the highest cycle first - skip older cycles
+  std::vector<TKey*> keys;
+  std::set<std::string> names;
+  for (TObject *object : *(file->GetListOfKeys())) {
+    TKey *key = (TKey*) object;
+    TClass *c = TClass::GetClass(key->GetClassName());
+    if (!c || !c->InheritsFrom(TCanvas::Class()))
+      continue;
+    if (!names.insert(key->GetName()).second)
+      continue;
+    keys.push_back(key);
+  }
+
+  // Canvases are read in parent process right before forking. Reading in workers would share the file offset
+  auto getCanvas = [&keys](UInt_t i) -> TCanvas* {
+    return (TCanvas*) keys[i]->ReadObj();
+  };
+  return saveCanvasesForked(keys.size(), getCanvas, kTRUE, format, nWorkers, callback);
+}
+
+void CanvasHelper::warmUpExport(UInt_t format) {
+  // Initialize TTF and load graphics libraries once in the parent. Forked workers inherit them copy-on-write
+  getTextExtentPx("0123456789", getFont(), kDefaultTheme.fontSizeNormal);
+  if ((format & kFormatPng) == kFormatPng) {
+    TClass::GetClass("TImage");
+    TClass::GetClass("TASImage");
+  }
+  if ((format & kFormatPs) == kFormatPs) {
+    TClass::GetClass("TPostScript");
   }
   if ((format & kFormatPdf) == kFormatPdf) {
-    canvas->SaveAs(fileName + ".pdf");
+    TClass::GetClass("TPDF");
+  }
+}
+
+std::vector<CanvasHelper::ExportResult> CanvasHelper::saveCanvasesForked(UInt_t nCanvases, std::function<TCanvas*(UInt_t)> getCanvas,
+    Bool_t ownsCanvases, UInt_t format, UInt_t nWorkers, std::function<void(const ExportResult&)> callback) {
+  std::vector<ExportResult> results(nCanvases, ExportResult{ "", kFALSE, -1 });
+  std::vector<Bool_t> finished(nCanvases, kFALSE);
+  UInt_t nextToReport = 0;
+
+  // Report results strictly in the input order
+  auto report = [&]() {
+    while (nextToReport < nCanvases && finished[nextToReport]) {
+      if (callback) callback(results[nextToReport]);
+      nextToReport++;
+    }
+  };
+
+  if (nWorkers == 0)
+    nWorkers = TMath::Max(1u, std::thread::hardware_concurrency());
+
+#ifndef _WIN32
+  // Workers must not talk to the display connection inherited from the parent
+  Bool_t useFork = gROOT->IsBatch() && nWorkers > 1;
+#else
+  Bool_t useFork = kFALSE;
+#endif
+
+  if (!useFork) {
+    for (UInt_t i = 0; i < nCanvases; i++) {
+      TCanvas *canvas = getCanvas(i);
+      if (canvas) {
+        results[i].canvasName = canvas->GetName();
+        results[i].success = saveCanvas(canvas, format);
+        results[i].exitCode = results[i].success ? 0 : 1;
+        if (ownsCanvases) delete canvas;
+      }
+      finished[i] = kTRUE;
+      report();
+    }
+    return results;
+  }
+
+#ifndef _WIN32
+  warmUpExport(format);
+
+  std::map<pid_t, UInt_t> running;
+  UInt_t next = 0;
+  while (next < nCanvases || !running.empty()) {
+    // Fill free worker slots
+    while (running.size() < nWorkers && next < nCanvases) {
+      UInt_t i = next++;
+      TCanvas *canvas = getCanvas(i);
+      if (canvas == nullptr) {
+        finished[i] = kTRUE;
+        continue;
+      }
+      results[i].canvasName = canvas->GetName();
+
+      // Flush buffers, otherwise pending output is duplicated in every child
+      std::cout.flush();
+      std::cerr.flush();
+      fflush(nullptr);
+
+      pid_t pid = fork();
+      if (pid == 0) {
+        // Worker: export one canvas and leave without running ROOT teardown
+        isExportWorker = kTRUE;
+        int code = 0;
+        try {
+          code = saveCanvas(canvas, format) ? 0 : 1;
+        } catch (...) {
+          code = 1;
+        }
+        fflush(nullptr);
+        _exit(code);
+      }
+      if (pid < 0) {
+        // Could not fork - export in this process
+        results[i].success = saveCanvas(canvas, format);
+        results[i].exitCode = results[i].success ? 0 : 1;
+        finished[i] = kTRUE;
+      } else {
+        running[pid] = i;
+      }
+      if (ownsCanvases) delete canvas;
+    }
+    report();
+
+    // All slots busy or nothing left to start - block until any worker exits
+    if (running.empty())
+      continue;
+    int status = 0;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      // No children left - workers were reaped elsewhere, their results are unknown
+      for (auto const &worker : running) {
+        CH_LOG(kLogExport, kLogError, "Lost worker of canvas \"" << results[worker.second].canvasName << "\"");
+        finished[worker.second] = kTRUE;
+      }
+      running.clear();
+      report();
+      continue;
+    }
+    // Child process not started here
+    auto it = running.find(pid);
+    if (it == running.end())
+      continue;
+    UInt_t i = it->second;
+    if (WIFEXITED(status)) {
+      results[i].exitCode = WEXITSTATUS(status);
+      results[i].success = results[i].exitCode == 0;
+    } else if (WIFSIGNALED(status)) {
+      results[i].exitCode = WTERMSIG(status);
+      results[i].success = kFALSE;
+    }
+    if (!results[i].success) {
+      CH_LOG(kLogExport, kLogError, "Export of canvas \"" << results[i].canvasName << "\" failed, code " << results[i].exitCode);
+    }
+    finished[i] = kTRUE;
+    running.erase(it);
+    report();
   }
+#endif
+
+  return results;
 }
 
 //Bool_t paveBelongsToHistogram(TPave* pave){
@@ -951,7 +3191,7 @@ void CanvasHelper::addTextToStats(const char *text, TPaveStats *stats, TVirtualP
   pad->Modified();
 }
 
-void CanvasHelper::convertAxisToPxSize(TAxis *axis, const char type, TVirtualPad *pad) {
+void CanvasHelper::convertAxisToPxSize(TAxis *axis, const char type, const PadModel &model, const PadLayout &layout) {
   if (axis == nullptr)
     return;
 
@@ -994,38 +3234,27 @@ void CanvasHelper::convertAxisToPxSize(TAxis *axis, const char type, TVirtualPad
 //        }
 //    }
 
+  // Shared axis of an interior pad - zero size labels and title are not painted
+  Bool_t hidden = (type == 'x' && layout.hideXAxis) || (type == 'y' && layout.hideYAxis);
+
   // Set tiles
-  axis->SetTitleFont(getFont());
-  axis->SetTitleSize(FONT_SIZE_NORMAL);
+  CH_SET(axis, TitleFont, getFont());
+  CH_SET(axis, TitleSize, hidden ? 0 : model.theme->fontSizeNormal);
   // TODO: figure how to adjust Y axis offsset - maybe not set it at all??
   if (type == 'x')
-    axis->SetTitleOffset(1.4);
+    CH_SET(axis, TitleOffset, 1.4);
   if (type == 'y') {
-    Double_t titleOffsetPx = (Double_t)getFrameLeftMarginPx(pad) - (Double_t)MARGIN_LEFT + 8;
-    Double_t coefficient = 30.; // Guestimated
     // Extra ratio seems to be needed - guestimated to be ratio of the frame width to pad width ???
-    axis->SetTitleOffset(titleOffsetPx / coefficient);
+    CH_SET(axis, TitleOffset, layout.yTitleOffset);
   }
 
   // Style labels
-  axis->SetLabelFont(getFont());
-  axis->SetLabelSize(FONT_SIZE_NORMAL);
-  Double_t labelOffset = AXIS_LABEL_OFFSET / (type == 'x' ? getPadHeightPx(pad) : getPadWidthPx(pad));
-  axis->SetLabelOffset(labelOffset);
+  CH_SET(axis, LabelFont, getFont());
+  CH_SET(axis, LabelSize, hidden ? 0 : model.theme->fontSizeNormal);
+  CH_SET(axis, LabelOffset, type == 'x' ? layout.xLabelOffset : layout.yLabelOffset);
 
   // Tick lengths
-  Double_t tickLength = AXIS_TICK_LENGTH / (type == 'x' ? getPadHeightPx(pad) : getPadWidthPx(pad));
-  axis->SetTickLength(tickLength);
-}
-
-Double_t CanvasHelper::pxToNdcHorizontal(Int_t px, TVirtualPad *pad) {
-  Double_t padWidth = getPadWidthPx(pad);
-  return px / padWidth;
-}
-
-Double_t CanvasHelper::pxToNdcVertical(Int_t py, TVirtualPad *pad) {
-  Double_t padHeight = getPadHeightPx(pad);
-  return py / padHeight;
+  CH_SET(axis, TickLength, type == 'x' ? layout.xTickLength : layout.yTickLength);
 }
 
 TFrame* CanvasHelper::getPadFrame(TVirtualPad *pad) {
@@ -1047,48 +3276,107 @@ UInt_t CanvasHelper::getPaveLines(TPave *pave) {
   return 1;
 }
 
-UInt_t CanvasHelper::getPaveTextWidthPx(TPaveText *paveText) {
+UInt_t CanvasHelper::getPaveTextWidthPx(TPaveText *paveText, const CanvasTheme &theme) {
   UInt_t maxTextLengthPx = 0;
   for (TObject *obj : *(paveText->GetListOfLines())) {
     if (!obj->InheritsFrom(TLatex::Class()))
       continue;
     TLatex *latex = (TLatex*) obj;
-    // TODO: try without cloning?
-    TLatex *latexCopy = (TLatex*) latex->Clone(TString::Format("%s_copy", latex->GetName()));
-    latexCopy->SetTextFont(getFont());
-    latexCopy->SetTextSize(FONT_SIZE_NORMAL);
-
-    UInt_t w = 0, h = 0;
-    latexCopy->GetBoundingBox(w, h);
+    UInt_t w = getTextExtentPx(latex->GetTitle(), getFont(), theme.fontSizeNormal).first;
     maxTextLengthPx = TMath::Max(maxTextLengthPx, w);
-
-    // UInt_t latexCopyWidthPx = getTextWidthPx(latexCopy);
-    // maxTextLengthPx = TMath::Max(maxTextLengthPx, latexCopyWidthPx);
-    latexCopy->Delete();
   }
-  return maxTextLengthPx + 25;
+  return maxTextLengthPx + theme.paveTextPadding;
 }
 
-UInt_t CanvasHelper::getLegendWidthPx(TLegend *legend) {
+UInt_t CanvasHelper::getLegendWidthPx(TLegend *legend, const CanvasTheme &theme) {
   UInt_t maxTextLengthPx = 0;
   for (TObject *obj : *(legend->GetListOfPrimitives())) {
     if (!obj->InheritsFrom(TLegendEntry::Class()))
       continue;
     TLegendEntry *entry = (TLegendEntry*) obj;
+    UInt_t w = getTextExtentPx(entry->GetLabel(), getFont(), theme.fontSizeNormal).first;
+    maxTextLengthPx = TMath::Max(maxTextLengthPx, w);
+  }
+  return maxTextLengthPx + theme.legendPadding;
+}
 
-    TLatex *latexCopy = new TLatex(0, 0, entry->GetLabel());
-    latexCopy->SetTextFont(getFont());
-    latexCopy->SetTextSize(FONT_SIZE_NORMAL);
+std::pair<UInt_t, UInt_t> CanvasHelper::getTextExtentPx(const char *text, Style_t font, Int_t sizePx, Bool_t isLatex) {
+  if (text == nullptr)
+    return std::make_pair(0, 0);
 
-    UInt_t w = 0, h = 0;
-    latexCopy->GetBoundingBox(w, h);
-    maxTextLengthPx = TMath::Max(maxTextLengthPx, w);
+  // Key is "font:size:kind:text". Extents of precision 3 fonts do not depend on the pad size.
+  std::string key = std::to_string(font) + ':' + std::to_string(sizePx) + (isLatex ? ":L:" : ":T:") + text;
+  std::pair<UInt_t, UInt_t> extent;
+  if (activeReport) activeReport->textMeasurements++;
+  if (textExtentCache.find(key, extent))
+    return extent;
 
-    // UInt_t latexCopyWidthPx = getTextWidthPx(latexCopy);
-    // maxTextLengthPx = TMath::Max(maxTextLengthPx, latexCopyWidthPx);
-    latexCopy->Delete();
+  warmUpFont(font, sizePx);
+  CH_LOG(kLogMeasurement, kLogDebug, "Measuring \"" << text << "\" font " << font << " size " << sizePx << "px");
+  UInt_t w = 0, h = 0;
+  if (isLatex) {
+    TLatex latex(0, 0, text);
+    latex.SetTextFont(font);
+    latex.SetTextSize(sizePx);
+    latex.GetBoundingBox(w, h);
+  } else {
+    TText t(0.5, 0.5, text);
+    t.SetNDC();
+    t.SetTextFont(font);
+    t.SetTextSize(sizePx);
+    t.GetBoundingBox(w, h);
   }
-  return maxTextLengthPx + 45;
+  extent = std::make_pair(w, h);
+  // Zero width means TTF was not ready yet - do not remember the wrong value
+  if (w > 0 || strlen(text) == 0)
+    textExtentCache.insert(key, extent);
+  return extent;
+}
+
+void CanvasHelper::warmUpFont(Style_t font, Int_t sizePx) {
+  // TTF sets up its engine and loads font files lazily. Extents measured before that come back wrong. Done once per process
+  static std::set<std::pair<Style_t, Int_t>> warmedUp;
+  if (!warmedUp.insert(std::make_pair(font, sizePx)).second)
+    return;
+
+  CH_LOG(kLogMeasurement, kLogDebug, "Warming up font " << font << " size " << sizePx << "px");
+  if (!TTF::IsInitialized())
+    TTF::Init();
+  TTF::SetTextFont(font);
+  TTF::SetTextSize(sizePx);
+  // Throwaway measurement on a stack object - nothing is added to any pad
+  UInt_t w = 0, h = 0;
+  TText t(0.5, 0.5, "0123456789");
+  t.SetNDC();
+  t.SetTextFont(font);
+  t.SetTextSize(sizePx);
+  t.GetBoundingBox(w, h);
+}
+
+void CanvasHelper::setLogLevel(ELogLevel level, UInt_t categories) {
+#ifndef NDEBUG
+  logLevel = level;
+  logCategories = categories;
+#else
+  (void) level;
+  (void) categories;
+#endif
+}
+
+void CanvasHelper::setTextExtentCacheCapacity(UInt_t capacity) {
+  textExtentCache.setCapacity(capacity);
+}
+
+void CanvasHelper::clearTextExtentCache() {
+  textExtentCache.clear();
+}
+
+ULong64_t CanvasHelper::getTextExtentCacheHits() {
+  return textExtentCache.hits;
+}
+
+ULong64_t CanvasHelper::getTextExtentCacheMisses() {
+  return textExtentCache.misses;
 }
 
 // TODO: To be deleted! - not working well
@@ -1206,21 +3494,43 @@ void CanvasHelper::addMultiCanvasTitle(TCanvas *canvas, const char *title, const
 
   alignChildPad(canvas);
 
-  alignTitle(canvas);
-  alignSubtitle(canvas);
+  PadModel model = buildPadModel(canvas);
+  PadGeometry geometry = Layout::computePad(getLayoutInput(model, kFALSE));
+  alignTitle(model, geometry);
+  alignSubtitle(model, geometry);
 
   canvas->Modified();
   canvas->Update();
 }
 
 void CanvasHelper::alignChildPad(TVirtualPad *canvas) {
-
-  TVirtualPad *childPad = (TVirtualPad*) canvas->GetPad(-1);
+  // Registered canvases know their container pad from the index
+  TCanvas *c = canvas->GetCanvas();
+  TVirtualPad *childPad = nullptr;
+  if (canvas == c && fgInstance && fgInstance->isCanvasRegistered(c)) {
+    childPad = fgInstance->getPadIndex(c).multiTitlePad;
+  } else {
+    childPad = (TVirtualPad*) canvas->GetPad(-1);
+  }
   if (childPad == nullptr)
     return;
 
-  Double_t childPadHeightNDC = 1 - pxToNdcVertical(getFrameTopMarginPx(canvas), canvas);
-  childPad->SetPad(0, 0, 1, childPadHeightNDC);
+  // Only the top margin matters here - no full pad model, no label measurement
+  Layout::PadInput input;
+  input.widthPx = getPadWidthPx(canvas);
+  input.heightPx = getPadHeightPx(canvas);
+  input.isChild = isChildPad(canvas);
+  input.hasTitle = canvas->GetPrimitive("title") != nullptr;
+  input.hasSubtitle = canvas->GetPrimitive("subtitle") != nullptr;
+  input.theme = getPadTheme(canvas);
+  Double_t childPadHeightNdc = 1 - Layout::getFrameTopMarginPx(input) / input.heightPx;
+
+  Double_t xlow, ylow, xup, yup;
+  childPad->GetPadPar(xlow, ylow, xup, yup);
+  if (xlow == 0 && ylow == 0 && xup == 1 && yup == childPadHeightNdc)
+    return;
+  // Repainted by the caller together with the rest of the canvas
+  childPad->SetPad(0, 0, 1, childPadHeightNdc);
   childPad->Modified();
-  childPad->Update();
+  attributeWrites++;
 }
@@ -12,19 +12,47 @@
 #include <TNamed.h>
 #include <TLine.h>
 #include <TQObject.h>
+#include <ROOT/RSpan.hxx>
 
 #include <utility>
 #include <map>
 #include <string>
+#include <vector>
+#include <functional>
+#include <set>
+#include <unordered_map>
+
+class TFile;
+class TTimer;
+class TTree;
+class TGraph;
+class TH1;
 
 /**
  * @namespace Round
  * Used for rounding parameter values in the ROOT statistics box to the first (or second) value of the corresponding error
  */
 namespace Round {
-  int getFirstDigit();
+  int getFirstDigit(double number);
+  int getDecimalPointShift(const double error);
   std::pair<double, double> valueError(const double value, const double error);
-  void paveTextValueErrors(TPaveText *pave);
+  /**
+   * @brief Rounds many value-error pairs at once. Gives the same result as calling valueError() for every pair.
+   * Also writes number of decimal digits to print each rounded pair with (-1 for non-positive or non-finite error).
+   * Pairs with such errors are passed through unchanged. Processes as many pairs as the shortest span holds.
+   *
+   * @code{.cpp}
+   * std::vector<double> v = {1.23456, 123.4}, e = {0.0123, 5.6}, rv(2), re(2);
+   * std::vector<int> digits(2);
+   * Round::valueErrors(v, e, rv, re, digits); // rv = {1.234, 123}, re = {0.012, 6}, digits = {3, 0}
+   * @endcode
+   */
+  void valueErrors(std::span<const double> values, std::span<const double> errors, std::span<double> roundedValues,
+      std::span<double> roundedErrors, std::span<int> decimals);
+  bool parseValueErrorLine(const char *line, size_t &prefixLength, double &value, double &error);
+  int formatValueError(char *buffer, int size, const double value, const double error);
+  // Returns number of lines that were rewritten
+  int paveTextValueErrors(TPaveText *pave);
 }
 
 /**
@@ -53,6 +81,238 @@ enum ECanvasFormatBits {
   kFormatPdf = BIT(18)       ///< save canvas as .pdf
 };
 
+/**
+ * Enum is used to tell that sub-pads of a divided canvas share axis ranges. Interior pads then do not show labels
+ * and titles of the shared axis and their margins collapse. Bits can be combined:
+ *
+ * @code{.cpp}
+ * CanvasHelper::getInstance()->addCanvas(myCanvas, kSharedAxisX | kSharedAxisY);
+ * @endcode
+ */
+enum ESharedAxesBits {
+  kSharedAxisX = BIT(0),      ///< pads in a grid column share x range - only the bottom pad shows x labels and title
+  kSharedAxisY = BIT(1),      ///< pads in a grid row share y range - only the leftmost pad shows y labels and title
+  kSharedAxesAuto = BIT(2)    ///< share requested axes only in columns (x) and rows (y) whose pads have equal user ranges
+};
+
+/**
+ * @struct CanvasTheme
+ * Sizes used to lay out canvases, in pixels. Default constructed theme gives the original CanvasHelper look.
+ * Derived sizes (scaled fonts, combined margins) are computed once by the constructor - create a new theme instead of
+ * changing base fields of an existing one.
+ *
+ * @code{.cpp}
+ * constexpr CanvasTheme presentation = CanvasTheme().scaled(1.5);
+ * CanvasHelper::getInstance()->setCanvasTheme(myCanvas, presentation);
+ * @endcode
+ */
+struct CanvasTheme {
+    // Base sizes
+    Int_t fontSizeNormal;
+    Double_t lineHeight;
+    Int_t axisLabelOffset;
+    Int_t axisTickLength;
+    Int_t marginLeft;
+    Int_t marginTop;        // In particular this is for TGaxis::PaintAxis() x10^3 label
+    Int_t marginRight;      // In particular this is for TGaxis::PaintAxis() x10^3 label
+    Int_t marginBottom;
+    Int_t titleVSpace;
+    Int_t subtitleVSpace;
+    Int_t paveLineVSpace;
+    Int_t axisTitleVSpace;
+    Int_t paveTextPadding;  // added to the longest stats box line
+    Int_t legendPadding;    // added to the longest legend entry, accounts on the entry symbol
+
+    // Derived sizes
+    Int_t fontSizeSmall;
+    Int_t fontSizeSmaller;
+    Int_t fontSizeLarge;
+    Int_t fontSizeLarger;
+    Int_t fontSizeHuge;
+    Int_t halfMarginTop;        // top margin of sub-pads, title offset
+    Int_t childTitleVSpace;     // title space of sub-pads
+    Int_t leftMarginBase;       // left frame margin without axis title and labels
+    Int_t bottomMarginBase;     // bottom frame margin without axis title
+
+    constexpr CanvasTheme(Int_t fontSizeNormal = 16, Double_t lineHeight = 1.2, Int_t axisLabelOffset = 6,
+                          Int_t axisTickLength = 20, Int_t marginLeft = 25, Int_t marginTop = 30, Int_t marginRight = 40,
+                          Int_t marginBottom = 10, Int_t titleVSpace = 25, Int_t subtitleVSpace = 20,
+                          Int_t paveLineVSpace = 22, Int_t axisTitleVSpace = 20, Int_t paveTextPadding = 25,
+                          Int_t legendPadding = 45) :
+        fontSizeNormal(fontSizeNormal), lineHeight(lineHeight), axisLabelOffset(axisLabelOffset),
+        axisTickLength(axisTickLength), marginLeft(marginLeft), marginTop(marginTop), marginRight(marginRight),
+        marginBottom(marginBottom), titleVSpace(titleVSpace), subtitleVSpace(subtitleVSpace),
+        paveLineVSpace(paveLineVSpace), axisTitleVSpace(axisTitleVSpace), paveTextPadding(paveTextPadding),
+        legendPadding(legendPadding),
+        fontSizeSmall(fontSizeNormal * 3. / 4.), fontSizeSmaller(Int_t(fontSizeNormal * 3. / 4.) * 3. / 4.),
+        fontSizeLarge(fontSizeNormal * 4. / 3.), fontSizeLarger(Int_t(fontSizeNormal * 4. / 3.) * 4. / 3.),
+        fontSizeHuge(Int_t(Int_t(fontSizeNormal * 4. / 3.) * 4. / 3.) * 4. / 3.),
+        halfMarginTop(marginTop / 2), childTitleVSpace(titleVSpace * 3. / 4.),
+        leftMarginBase(marginLeft + axisLabelOffset), bottomMarginBase(marginBottom + fontSizeNormal + axisLabelOffset) {
+    }
+
+    /**
+     * @brief Theme with all sizes multiplied by given factor. Useful for HiDPI and presentation output.
+     */
+    constexpr CanvasTheme scaled(Double_t factor) const {
+      return CanvasTheme(Int_t(fontSizeNormal * factor + 0.5), lineHeight, Int_t(axisLabelOffset * factor + 0.5),
+                         Int_t(axisTickLength * factor + 0.5), Int_t(marginLeft * factor + 0.5),
+                         Int_t(marginTop * factor + 0.5), Int_t(marginRight * factor + 0.5),
+                         Int_t(marginBottom * factor + 0.5), Int_t(titleVSpace * factor + 0.5),
+                         Int_t(subtitleVSpace * factor + 0.5), Int_t(paveLineVSpace * factor + 0.5),
+                         Int_t(axisTitleVSpace * factor + 0.5), Int_t(paveTextPadding * factor + 0.5),
+                         Int_t(legendPadding * factor + 0.5));
+    }
+
+    constexpr Bool_t operator==(const CanvasTheme &other) const {
+      return fontSizeNormal == other.fontSizeNormal && lineHeight == other.lineHeight
+          && axisLabelOffset == other.axisLabelOffset && axisTickLength == other.axisTickLength
+          && marginLeft == other.marginLeft && marginTop == other.marginTop && marginRight == other.marginRight
+          && marginBottom == other.marginBottom && titleVSpace == other.titleVSpace
+          && subtitleVSpace == other.subtitleVSpace && paveLineVSpace == other.paveLineVSpace
+          && axisTitleVSpace == other.axisTitleVSpace && paveTextPadding == other.paveTextPadding
+          && legendPadding == other.legendPadding;
+    }
+
+    constexpr Bool_t operator!=(const CanvasTheme &other) const {
+      return !(*this == other);
+    }
+};
+
+/**
+ * @namespace Layout
+ * Pad layout math on plain structs. Nothing here reads or writes ROOT objects, so pads of many canvases can be laid out
+ * ahead of time, in parallel or without any canvas at all. CanvasHelper fills the inputs from live pads (including text
+ * measurements) and applies the results in a separate serial pass.
+ *
+ * @code{.cpp}
+ * Layout::PadInput pad;
+ * pad.widthPx = 400;
+ * pad.heightPx = 300;
+ * pad.hasYAxisTitle = kTRUE;
+ * pad.yAxisMaxLabelWidthPx = 30;
+ * pad.paves.push_back({ 150, 66, kPaveAlignRight | kPaveAlignTop });
+ * Layout::PadGeometry geometry = Layout::computePad(pad);
+ * @endcode
+ */
+namespace Layout {
+  /**
+   * @brief Measured size of a stats box, legend or other pave and its EPaveAlignBits.
+   */
+  struct PaveInput {
+      Double_t widthPx;
+      Int_t heightPx;
+      UInt_t align;
+  };
+
+  /**
+   * @brief Everything the layout of a single pad depends on.
+   */
+  struct PadInput {
+      Double_t widthPx = 0;
+      Double_t heightPx = 0;
+      Bool_t isChild = kFALSE;               ///< sub-pad of a divided canvas - smaller title and top margin
+      Bool_t hasTitle = kFALSE;
+      Bool_t hasSubtitle = kFALSE;
+      Bool_t hasXAxisTitle = kFALSE;
+      Bool_t hasYAxisTitle = kFALSE;
+      Bool_t hideXAxis = kFALSE;             ///< interior pad of a column with shared x axis
+      Bool_t hideYAxis = kFALSE;             ///< interior pad of a row with shared y axis
+      Double_t yAxisMaxLabelWidthPx = 0;
+      CanvasTheme theme;
+      std::vector<PaveInput> paves;
+  };
+
+  struct Margin {
+      Double_t left;
+      Double_t right;
+      Double_t bottom;
+      Double_t top;
+  };
+
+  /**
+   * @brief Frame margins and axis sizes. Depends only on the pad shape - equal for pads with equal getShapeKey().
+   */
+  struct PadLayout {
+      Int_t leftMarginPx;
+      Int_t rightMarginPx;
+      Int_t topMarginPx;
+      Int_t bottomMarginPx;
+      Margin marginNdc;
+      Double_t xLabelOffset;
+      Double_t yLabelOffset;
+      Double_t xTickLength;
+      Double_t yTickLength;
+      Double_t yTitleOffset;
+      Int_t nDivXMajor;
+      Int_t nDivYMajor;
+      Bool_t hideXAxis;
+      Bool_t hideYAxis;
+  };
+
+  /**
+   * @brief Rectangle in pad NDC coordinates.
+   */
+  struct Box {
+      Double_t x1;
+      Double_t y1;
+      Double_t x2;
+      Double_t y2;
+  };
+
+  /**
+   * @brief Complete layout of a pad. Pave boxes follow the order of PadInput::paves, only edges given by the
+   * alignment bits of a pave are meaningful.
+   */
+  struct PadGeometry {
+      PadLayout layout;
+      Box title;
+      Int_t titleTextSize;
+      Box subtitle;
+      std::vector<Box> paves;
+      Double_t childPadHeightNdc;            ///< height of the pad holding sub-pads of a canvas with multi-pad title
+  };
+
+  Int_t getFrameLeftMarginPx(const PadInput &pad);
+  Int_t getFrameRightMarginPx(const PadInput &pad);
+  Int_t getFrameTopMarginPx(const PadInput &pad);
+  Int_t getFrameBottomMarginPx(const PadInput &pad);
+  Box getTitleBox(const PadInput &pad);
+  Box getSubtitleBox(const PadInput &pad);
+  Box getPaveBox(const PadInput &pad, const PadLayout &layout, const PaveInput &pave);
+
+  /**
+   * @brief Everything computePadLayout() derives its result from. Pads with equal keys get identical layouts.
+   */
+  struct ShapeKey {
+      Double_t widthPx;
+      Double_t heightPx;
+      Int_t leftMarginPx;
+      Int_t rightMarginPx;
+      Int_t topMarginPx;
+      Int_t bottomMarginPx;
+      Int_t axisLabelOffset;
+      Int_t axisTickLength;
+      Int_t marginLeft;
+      Bool_t hideXAxis;
+      Bool_t hideYAxis;
+
+      Bool_t operator==(const ShapeKey &other) const;
+      Bool_t operator<(const ShapeKey &other) const;
+  };
+
+  ShapeKey getShapeKey(const PadInput &pad);
+  PadLayout computePadLayout(const PadInput &pad);
+  PadGeometry computePad(const PadInput &pad, const PadLayout &layout);
+  PadGeometry computePad(const PadInput &pad);
+
+  /**
+   * @brief Lay out many pads, possibly of different canvases.
+   * With implicit multi-threading enabled (ROOT::EnableImplicitMT()) pads are computed by a TThreadExecutor.
+   */
+  void computePads(const std::vector<PadInput> &pads, std::vector<PadGeometry> &geometries);
+}
+
 /**
  * @class TNamedLine TNamedLine.h "TNamedLine.h"
  * ROOT TLine that has a name to access it on the pad
@@ -94,12 +354,241 @@ class CanvasHelper: public TObject {
      * @brief Register your canvas for processing.
      * Canvas needs to be added after all the primitives are drawn on it.
      * @param canvas Canvas to be processed.
+     * @param sharedAxes Optional binary combination of ESharedAxesBits for divided canvases.
      *
      * @code{.cpp}
      * CavasHelper::getInstance()->addCanvas(myCanvas);
      * @endcode
      */
-    void addCanvas(TCanvas *canvas);
+    void addCanvas(TCanvas *canvas, UInt_t sharedAxes = 0);
+
+    /**
+     * @brief Change shared axes mode of a registered canvas. Canvas is laid out once if the mode differs.
+     * @param canvas Registered canvas.
+     * @param sharedAxes Binary combination of ESharedAxesBits. Zero shows all axes.
+     */
+    void setSharedAxes(TCanvas *canvas, UInt_t sharedAxes);
+
+    /**
+     * @brief Paint large graphs of a registered canvas with at most a few points per pixel column.
+     * Graphs with many more points than pixels across the frame are replaced in the pad (or TMultiGraph) by a display copy
+     * holding the first, last, minimum and maximum point of every pixel column. Original graphs are not modified, they are
+     * put back when decimation is disabled or the canvas is removed. Files .root and .c are written with the originals.
+     * Display copies are recomputed on resize and zoom, when the point count changes, when the pad is marked Modified() or
+     * the canvas is passed to requestRefresh(). Only graphs with ascending x values are decimated. Only plain TGraph
+     * objects (not TGraphErrors or other subclasses) are decimated.
+     * @param canvas Registered canvas.
+     * @param enable Enable or disable decimation. Disabled by default.
+     *
+     * @code{.cpp}
+     * CanvasHelper::getInstance()->addCanvas(myCanvas);
+     * CanvasHelper::getInstance()->setGraphDecimation(myCanvas, kTRUE);
+     * @endcode
+     */
+    void setGraphDecimation(TCanvas *canvas, Bool_t enable);
+
+    /**
+     * @brief Paint very fine TH1 and TH2 histograms of a registered canvas with about one bin per pixel.
+     * Histograms with more visible bins than pixels across the frame are replaced in the pad by a display copy. Neighbouring
+     * bins are merged and keep the maximum content, so peaks stay visible. Bin edges of the copy are edges of the original.
+     * Statistics, functions, axis attributes and zoom are kept. Copy is cached until the pad range, bin count, entries or
+     * statistics change, the pad is marked Modified() or the canvas is passed to requestRefresh().
+     * Original histograms are put back as for graph decimation. Labelled axes and profiles are not rebinned.
+     * @param canvas Registered canvas.
+     * @param enable Enable or disable rebinning. Disabled by default.
+     *
+     * @code{.cpp}
+     * CanvasHelper::getInstance()->setHistogramRebinning(myCanvas, kTRUE);
+     * @endcode
+     */
+    void setHistogramRebinning(TCanvas *canvas, Bool_t enable);
+
+    /**
+     * @brief Live mode for registered canvases that are refilled and updated several times per second (online monitoring).
+     * Pads keep their layout between refreshes. Every repaint only checks if the y axis range changed and measures the
+     * longest y label. Label widths are rounded up to buckets of about one digit. Pad is laid out again only when its
+     * labels need a wider bucket, or fit into a bucket at least two steps narrower - margins do not jump back and forth
+     * when the range oscillates around a bucket boundary. Pads are laid out from the event loop after painting, at most
+     * maxPadsPerRefresh pads at a time, remaining pads follow on the next iteration.
+     * @param canvas Registered canvas.
+     * @param enable Enable or disable live mode. Disabled by default.
+     * @param maxPadsPerRefresh Maximum number of pads laid out per event loop iteration.
+     *
+     * @code{.cpp}
+     * CanvasHelper::getInstance()->addCanvas(monitorCanvas);
+     * CanvasHelper::getInstance()->setLiveMode(monitorCanvas, kTRUE);
+     * // In the DAQ loop
+     * hist->Fill(value);
+     * monitorCanvas->Modified();
+     * monitorCanvas->Update();
+     * @endcode
+     */
+    void setLiveMode(TCanvas *canvas, Bool_t enable, UInt_t maxPadsPerRefresh = 4);
+
+    /**
+     * @brief Stop processing the canvas. Canvases are also removed automatically when deleted or closed.
+     * @param canvas Previously registered canvas.
+     */
+    void removeCanvas(TCanvas *canvas);
+
+    /**
+     * @brief Check if canvas is registered for processing.
+     * @param canvas Canvas to look up.
+     */
+    Bool_t isCanvasRegistered(TCanvas *canvas) const;
+
+    /**
+     * @brief Number of canvases currently registered for processing.
+     */
+    UInt_t getRegisteredCanvasesCount() const;
+
+    /**
+     * @brief List of canvases currently registered for processing.
+     */
+    std::vector<TCanvas*> getRegisteredCanvases() const;
+
+    /**
+     * @brief Lay out many registered canvases in one pass. Pads of all canvases are read first, their layout is computed
+     * at once (in parallel if ROOT implicit multi-threading is enabled), then pads are updated canvas by canvas.
+     * Unregistered canvases are ignored.
+     * @param canvases Registered canvases.
+     *
+     * @code{.cpp}
+     * ROOT::EnableImplicitMT();
+     * CanvasHelper::getInstance()->processCanvases(CanvasHelper::getInstance()->getRegisteredCanvases());
+     * @endcode
+     */
+    void processCanvases(const std::vector<TCanvas*> &canvases);
+
+    /**
+     * @brief Number of pads skipped during the last layout pass of the canvas because nothing changed since previous layout.
+     * Pads are compared by a fingerprint of pixel size, axis ranges, titles, pave contents and pave alignment bits.
+     * @param canvas Registered canvas.
+     */
+    UInt_t getSkippedPadsCount(TCanvas *canvas) const;
+
+    /**
+     * @brief Number of object attributes (fonts, sizes, offsets, margins, pave coordinates...) set during the last layout
+     * pass of the canvas. Attributes are compared with the current values first, only different ones are set. Laid out
+     * pads without any written attribute are not marked as modified and are not repainted.
+     * @param canvas Registered canvas.
+     */
+    ULong64_t getAttributesWrittenCount(TCanvas *canvas) const;
+
+    /**
+     * Layout phases measured by the layout cost report.
+     */
+    enum ELayoutPhase {
+      kPhaseConvertAxis,              ///< convertAxisToPxSize() for both axes
+      kPhaseAlignTitle,               ///< alignTitle() and alignSubtitle()
+      kPhaseAlignAllPaves,            ///< alignAllPaves()
+      kPhaseSetPadMargins,            ///< setPadMargins()
+      kPhaseSetPadCustomFrameBorder,  ///< setPadCustomFrameBorder()
+      kPhaseSetPadNDivisions,         ///< setPadNDivisions()
+      kPhaseUpdate,                   ///< single canvas Update() at the end of the pass
+      kNLayoutPhases
+    };
+
+    /**
+     * @brief Cost of the last layout pass of a canvas. Collected only when layout profiling is enabled.
+     */
+    struct LayoutReport {
+        Double_t phaseMs[kNLayoutPhases];   ///< wall time per phase in milliseconds, indexed by ELayoutPhase
+        Double_t totalMs;                   ///< wall time of the whole processCanvas() pass
+        ULong64_t textMeasurements;         ///< number of text extent requests (cached or not)
+        ULong64_t primitivesScanned;        ///< number of pad primitives visited while building pad models
+        ULong64_t objectsAllocated;         ///< number of ROOT objects allocated on the heap (frame lines, display copies)
+        UInt_t padsProcessed;               ///< number of pads laid out
+        UInt_t padsSkipped;                 ///< number of unchanged pads skipped
+        UInt_t layoutClasses;               ///< number of distinct pad shapes among laid out pads
+        ULong64_t attributesWritten;        ///< number of object attributes that differed and were set
+        UInt_t padsRepainted;               ///< number of laid out pads with changed attributes, only these are repainted
+    };
+
+    /**
+     * @brief Enable or disable collecting layout cost reports. Disabled by default.
+     * @param enable Enable profiling of the processCanvas() passes.
+     */
+    void setLayoutProfiling(Bool_t enable);
+
+    /**
+     * @brief Obtain the cost report of the last layout pass of a registered canvas.
+     * @param canvas Registered canvas.
+     *
+     * @code{.cpp}
+     * CanvasHelper::getInstance()->setLayoutProfiling(kTRUE);
+     * CanvasHelper::getInstance()->addCanvas(myCanvas);
+     * CanvasHelper::LayoutReport report = CanvasHelper::getInstance()->getLayoutReport(myCanvas);
+     * @endcode
+     */
+    LayoutReport getLayoutReport(TCanvas *canvas) const;
+
+    /**
+     * @brief Print layout cost reports of all registered canvases as a table.
+     */
+    void printLayoutReports() const;
+
+    /**
+     * @brief Layout cost reports of all registered canvases as a TTree - one entry per canvas.
+     * Tree is not attached to any directory. Caller takes the ownership.
+     */
+    TTree* getLayoutReportsTree() const;
+
+    /**
+     * @brief Queue a refresh of a registered canvas after its objects were refilled: layout of changed pads and repaint.
+     * Refreshes run from the event loop in ticks. Every tick refreshes queued canvases until the time budget is used up,
+     * remaining canvases wait for the next tick. Canvases the user clicked, typed in or resized during the last two
+     * seconds go first, then canvases shown on screen, then the rest, oldest requests first. Requests waiting longer than
+     * the maximum latency go before all others. Repeated requests for a queued canvas are merged.
+     * @param canvas Registered canvas.
+     *
+     * @code{.cpp}
+     * for (TCanvas *canvas : monitorCanvases) {
+     *   CanvasHelper::getInstance()->requestRefresh(canvas);
+     * }
+     * @endcode
+     */
+    void requestRefresh(TCanvas *canvas);
+
+    /**
+     * @brief Set timing of the refresh scheduler.
+     * @param budgetMs Time spent on refreshes per tick. At least one canvas is refreshed every tick. Default is 10 ms.
+     * @param periodMs Interval between ticks. Default is 40 ms.
+     * @param maxLatencyMs Requests waiting longer are refreshed first regardless of priority. Default is 1000 ms.
+     */
+    void setRefreshBudget(Double_t budgetMs, Long_t periodMs = 40, Double_t maxLatencyMs = 1000);
+
+    /**
+     * @brief Statistics of the refresh scheduler since start or last reset.
+     */
+    struct RefreshStats {
+        UInt_t queueDepth;                  ///< canvases waiting for refresh now
+        UInt_t maxQueueDepth;               ///< largest number of canvases waiting
+        ULong64_t requests;                 ///< requestRefresh() calls
+        ULong64_t merged;                   ///< requests merged into one already queued
+        ULong64_t refreshes;                ///< canvases refreshed
+        ULong64_t ticks;                    ///< scheduler ticks
+        ULong64_t deferredTicks;            ///< ticks that used up the budget and left canvases waiting
+        Double_t meanLatencyMs;             ///< mean time from the first request to the end of refresh
+        Double_t maxLatencyMs;              ///< longest time from the first request to the end of refresh
+        Double_t meanTickMs;                ///< mean wall time of a tick
+        Double_t maxTickMs;                 ///< longest tick
+    };
+
+    /**
+     * @brief Obtain refresh scheduler statistics.
+     *
+     * @code{.cpp}
+     * CanvasHelper::RefreshStats stats = CanvasHelper::getInstance()->getRefreshStats();
+     * std::cout << stats.queueDepth << " waiting, " << stats.meanLatencyMs << " ms mean latency" << std::endl;
+     * @endcode
+     */
+    RefreshStats getRefreshStats() const;
+
+    /**
+     * @brief Reset refresh scheduler statistics. Queued requests stay queued.
+     */
+    void resetRefreshStats();
 
     /**
      * @brief Add subtitle to the canvas.
@@ -182,23 +671,203 @@ class CanvasHelper: public TObject {
     static void addMultiCanvasTitle(TCanvas *canvas, const char *title, const char *subtitle = "");
 
     /**
-     * Function saves canvas to disk in certain format. Formats are manipulated as bits:
+     * Function saves canvas to disk in certain format. Formats are manipulated as bits.
+     * Canvas is updated once and all formats reuse that state. In batch mode .root, .c and .png files
+     * are written by forked workers while .ps and .pdf are painted in the current process.
+     * Returns kTRUE if every file was written and is not empty. Failures are logged as export errors:
      *
      * @code{.cpp}
      * CavasHelper::saveCanvas(myCanvas, kCanvasPng | kCanvasPs | kCanvasRoot | kCanvasC);
      * @endcode*
      */
-    static void saveCanvas(TCanvas *canvas, UInt_t format);
+    static Bool_t saveCanvas(TCanvas *canvas, UInt_t format);
+
+    /**
+     * @brief Outcome of a single canvas export performed by saveCanvases().
+     */
+    struct ExportResult {
+        TString canvasName;   ///< name of the exported canvas (used as file name)
+        Bool_t success;       ///< kTRUE if all requested formats were written
+        Int_t exitCode;       ///< worker exit code, or signal number if worker was killed
+    };
+
+    /**
+     * @brief Save many canvases in forked worker processes, at most nWorkers at a time.
+     * Fonts and graphics libraries are loaded before forking so workers share them copy-on-write.
+     * Every canvas is exported in its own short-lived process - a crash affects only that canvas.
+     * Results are reported via callback in the order of the input list.
+     * Without fork() support or outside of batch mode canvases are saved sequentially.
+     * @param canvases List of canvases to be exported.
+     * @param format Binary combination of ECanvasFormatBits.
+     * @param nWorkers Maximum number of concurrent worker processes. Zero means number of CPU cores.
+     * @param callback Optional function called once per canvas in input order as soon as its result is known.
+     *
+     * @code{.cpp}
+     * gROOT->SetBatch(kTRUE);
+     * CanvasHelper::saveCanvases(myCanvases, kFormatPng | kFormatPdf, 8);
+     * @endcode
+     */
+    static std::vector<ExportResult> saveCanvases(const std::vector<TCanvas*> &canvases, UInt_t format, UInt_t nWorkers = 0,
+                                                  std::function<void(const ExportResult&)> callback = nullptr);
+
+    /**
+     * @brief Save all canvases stored in a ROOT file in forked worker processes, at most nWorkers at a time.
+     * Only the highest cycle of every canvas key is exported. Canvases are read one by one right before forking.
+     * @param file ROOT file containing canvases.
+     * @param format Binary combination of ECanvasFormatBits.
+     * @param nWorkers Maximum number of concurrent worker processes. Zero means number of CPU cores.
+     * @param callback Optional function called once per canvas in file key order.
+     */
+    static std::vector<ExportResult> saveCanvases(TFile *file, UInt_t format, UInt_t nWorkers = 0,
+                                                  std::function<void(const ExportResult&)> callback = nullptr);
+
+    /**
+     * @brief Set quiet period for processing resized canvases.
+     * Bursts of resize signals (e.g. window drag) are coalesced per canvas. Layout is done once for the final canvas size
+     * after no resize signals were received for given number of milliseconds. Zero disables coalescing.
+     * @param milliseconds Quiet period in milliseconds. Default is 150 ms.
+     *
+     * @code{.cpp}
+     * CanvasHelper::getInstance()->setResizeDelay(250);
+     * @endcode
+     */
+    void setResizeDelay(Long_t milliseconds);
+
+    /**
+     * @brief Run a cheap margins-only pass right on every resize signal, before the full deferred layout.
+     * Keeps frame and child pads in place while window is being dragged.
+     * @param enable Enable or disable the immediate pass. Disabled by default.
+     */
+    void setResizeImmediatePass(Bool_t enable);
+
+    /**
+     * @brief Align frames of sub-pads in the same grid column by using the widest y axis labels of the column.
+     * Pads of uniform grids then share one layout per column. Disabled by default.
+     * @param enable Enable or disable column alignment.
+     *
+     * @code{.cpp}
+     * canvas->Divide(8, 8);
+     * CanvasHelper::getInstance()->setGridColumnAlignment(kTRUE);
+     * CanvasHelper::getInstance()->addCanvas(canvas);
+     * @endcode
+     */
+    void setGridColumnAlignment(Bool_t enable);
+
+    /**
+     * @brief Lazy registration. Canvases added with addCanvas() are only marked. Layout runs once right before the canvas
+     * is needed: before saveCanvas(), before a scheduled refresh or processCanvases(), or from the event loop right after
+     * the first time the canvas is painted on screen. Canvases that are never shown nor saved cost nothing. Useful in
+     * batch jobs that create many canvases and save only some of them. Disabled by default.
+     * @param enable Enable or disable lazy registration for canvases added from now on.
+     *
+     * @code{.cpp}
+     * CanvasHelper::getInstance()->setLazyRegistration(kTRUE);
+     * CanvasHelper::getInstance()->addCanvas(myCanvas);             // only marks the canvas
+     * CanvasHelper::saveCanvas(myCanvas, kFormatPng);                // layout runs here, once
+     * @endcode
+     */
+    void setLazyRegistration(Bool_t enable);
+
+    /**
+     * Categories of diagnostic messages. Categories can be combined as bits.
+     */
+    enum ELogCategory {
+      kLogLayout = BIT(0),        ///< canvas and pad layout passes
+      kLogMeasurement = BIT(1),   ///< text extent measurements
+      kLogExport = BIT(2),        ///< saving canvases to files
+      kLogRegistry = BIT(3),      ///< adding and removing canvases
+      kLogAll = kLogLayout | kLogMeasurement | kLogExport | kLogRegistry
+    };
+
+    /**
+     * Verbosity levels of diagnostic messages.
+     */
+    enum ELogLevel {
+      kLogError = 0,     ///< only errors
+      kLogWarning = 1,   ///< errors and warnings (default)
+      kLogInfo = 2,      ///< informational messages
+      kLogDebug = 3      ///< detailed per-pad output
+    };
+
+    /**
+     * @brief Set verbosity of diagnostic messages. Diagnostics are compiled out in release builds (NDEBUG) and this call has no effect there.
+     * @param level Maximum level of messages to be printed.
+     * @param categories Binary combination of ELogCategory.
+     *
+     * @code{.cpp}
+     * CanvasHelper::setLogLevel(CanvasHelper::kLogDebug, CanvasHelper::kLogLayout | CanvasHelper::kLogExport);
+     * @endcode
+     */
+    static void setLogLevel(ELogLevel level, UInt_t categories = kLogAll);
+
+    /**
+     * @brief Set maximum number of text extents kept in the measurement cache.
+     * Least recently used entries are evicted once the capacity is reached.
+     * @param capacity Maximum number of cached (font, size, string) extents.
+     */
+    static void setTextExtentCacheCapacity(UInt_t capacity);
+
+    /**
+     * @brief Drop all cached text extents.
+     * Call if font setup was changed at runtime (e.g. different TTF fonts were loaded).
+     */
+    static void clearTextExtentCache();
+
+    /**
+     * @brief Number of text measurements served from the cache.
+     */
+    static ULong64_t getTextExtentCacheHits();
+
+    /**
+     * @brief Number of text measurements that required TTF to measure a string.
+     */
+    static ULong64_t getTextExtentCacheMisses();
+
+    /**
+     * @brief Set theme for canvases registered after this call. Already registered canvases keep their themes.
+     * @param theme Sizes used for layout.
+     */
+    void setDefaultTheme(const CanvasTheme &theme);
+
+    /**
+     * @brief Set theme of a registered canvas. Canvas is laid out once with new sizes if theme differs from the current one.
+     * @param canvas Registered canvas.
+     * @param theme Sizes used for layout.
+     *
+     * @code{.cpp}
+     * CanvasHelper::getInstance()->setCanvasTheme(myCanvas, CanvasTheme().scaled(2)); // HiDPI
+     * @endcode
+     */
+    void setCanvasTheme(TCanvas *canvas, const CanvasTheme &theme);
+
+    /**
+     * @brief Theme of a registered canvas. Default theme is returned for unregistered canvases.
+     */
+    const CanvasTheme& getCanvasTheme(TCanvas *canvas) const;
 
   protected:
     CanvasHelper();
     static CanvasHelper *fgInstance;
 
-    struct Margin {
-        Double_t left;
-        Double_t right;
-        Double_t bottom;
-        Double_t top;
+    // Snapshot of pad primitives and geometry. Built in one pass over the primitives and shared by all alignment functions
+    struct PadModel {
+        TVirtualPad *pad = nullptr;
+        TAxis *xAxis = nullptr;
+        TAxis *yAxis = nullptr;
+        TObject *plot = nullptr;            // first object with axes - histogram, stack, graph, function
+        TObject *title = nullptr;
+        TObject *subtitle = nullptr;
+        std::vector<TPave*> paves;        // stats boxes, legends and other paves that can be aligned
+        TFrame *frame = nullptr;
+        TLine *frameTopLine = nullptr;
+        TLine *frameRightLine = nullptr;
+        Double_t widthPx = 0;
+        Double_t heightPx = 0;
+        Double_t yAxisMaxLabelWidthPx = 0;
+        Bool_t isChild = kFALSE;
+        const CanvasTheme *theme = nullptr;
+        Bool_t hideXAxis = kFALSE;          // interior pad of a column with shared x range
+        Bool_t hideYAxis = kFALSE;          // interior pad of a row with shared y range
     };
 
     enum EFontFace {
@@ -219,39 +888,160 @@ class CanvasHelper: public TObject {
       SymbolItalic = 15
     };
 
-    // Font sizes in pixels
-    static const Int_t FONT_SIZE_NORMAL;
-    static const Int_t FONT_SIZE_SMALL;
-    static const Int_t FONT_SIZE_SMALLER;
-    static const Int_t FONT_SIZE_LARGE;
-    static const Int_t FONT_SIZE_LARGER;
-    static const Int_t FONT_SIZE_HUGE;
+    // Built-in theme, also used for unregistered canvases. Newly registered canvases get defaultTheme
+    static constexpr CanvasTheme kDefaultTheme = CanvasTheme();
+    CanvasTheme defaultTheme;
+    static const CanvasTheme& getPadTheme(TVirtualPad *pad);
 
-    static const Double_t LINE_HEIGHT;
+    static Style_t getFont(EFontFace fontFace = EFontFace::Helvetica);
+    static UInt_t getPaveLines(TPave *pave);
+    static UInt_t getPaveTextWidthPx(TPaveText *paveText, const CanvasTheme &theme = kDefaultTheme);
+    static UInt_t getLegendWidthPx(TLegend *legend, const CanvasTheme &theme = kDefaultTheme);
+    static std::pair<UInt_t, UInt_t> getTextExtentPx(const char *text, Style_t font, Int_t sizePx, Bool_t isLatex = kTRUE);
+    static void warmUpFont(Style_t font, Int_t sizePx);
+    static Bool_t needsFirstPaint(TVirtualPad *pad);
 
-//    static const Int_t AXIS_TITLE_OFFSET;
-    static const Int_t AXIS_LABEL_OFFSET;
-    static const Int_t AXIS_TICK_LENGTH;
+    // TMap *canvasesToBeExported;
 
-    static const Int_t MARGIN_LEFT;
-    static const Int_t MARGIN_TOP;
-    static const Int_t MARGIN_RIGHT;
-    static const Int_t MARGIN_BOTTOM;
+    // Position of a pad in the canvas pad tree
+    struct PadNode {
+        TVirtualPad *parent = nullptr;
+        Int_t depth = 0;                          // canvas itself is 0
+        Int_t column = 0;                         // grid position among siblings, counted from left
+        Int_t row = 0;                            // counted from top
+        Bool_t isMultiTitleContainer = kFALSE;    // pad created by addMultiCanvasTitle() to hold the original sub-pads
+        Bool_t isChild = kFALSE;
+    };
 
-    static const Int_t TITLE_VSPACE;
-    static const Int_t SUBTITLE_VSPACE;
-    static const Int_t PAVELINE_VSPACE;
-    static const Int_t AXISTITLE_VSPACE;
+    // Structural index of canvas pads. Rebuilt only when the signature of the pad tree changes
+    struct PadIndex {
+        ULong64_t signature = 0;
+        TVirtualPad *multiTitlePad = nullptr;
+        std::vector<TVirtualPad*> layoutPads;     // numbered sub-pads laid out before the canvas itself
+        std::unordered_map<TVirtualPad*, PadNode> nodes;
+    };
 
-    static Style_t getFont(EFontFace fontFace = EFontFace::Helvetica);
-    static UInt_t getPaveLines(TPave *pave);
-    static UInt_t getPaveTextWidthPx(TPaveText *paveText);
-    static UInt_t getLegendWidthPx(TLegend *paveText);
+    static ULong64_t getPadTreeSignature(TVirtualPad *canvas);
+    static void buildPadIndex(TCanvas *canvas, PadIndex &index);
+    static void indexSubPads(TVirtualPad *parent, Int_t depth, PadIndex &index);
+    const PadIndex& getPadIndex(TCanvas *canvas);
+    static const PadNode* findPadNode(TVirtualPad *pad);
 
-    // TMap *canvasesToBeExported;
-    static std::pair<Double_t, Double_t> getSubtitleYNDCCoordinates(TVirtualPad *pad);
+    // Live mode state of a pad - y range the labels were last measured for and label width bucket of the current layout
+    struct LivePad {
+        Double_t yMin = 0;
+        Double_t yMax = 0;
+        Bool_t logY = kFALSE;
+        Bool_t hasYAxis = kFALSE;
+        Int_t bucket = -1;
+    };
+    static Double_t getLiveBucketPx(const CanvasTheme &theme);
+    static Bool_t applyLiveLabelWidth(LivePad &live, PadModel &model);
+
+    // Per canvas state. Entries are erased in RecursiveRemove() when canvas is deleted
+    struct CanvasEntry {
+        UInt_t width;
+        UInt_t height;
+        std::unordered_map<TVirtualPad*, ULong64_t> padFingerprints;   // state of every pad after its last layout
+        UInt_t skippedPads;
+        ULong64_t attributesWritten = 0;
+        LayoutReport report;
+        PadIndex padIndex;
+        CanvasTheme theme;
+        UInt_t sharedAxes = 0;
+        Bool_t graphDecimation = kFALSE;
+        Bool_t histogramRebinning = kFALSE;
+        Bool_t liveMode = kFALSE;
+        UInt_t liveBudget = 4;
+        std::unordered_map<TVirtualPad*, LivePad> livePads;
+        std::set<TVirtualPad*> pendingLivePads;       // label bucket changed, waiting for layout
+        Double_t lastInteractionMs = -1;              // steady clock time of the last user event, negative if none
+        Bool_t layoutPending = kFALSE;                // lazily registered canvas that was not laid out yet
+    };
+    Bool_t layoutProfiling;
+    std::unordered_map<TCanvas*, CanvasEntry> registeredCanvases;
+
+    // Resized canvases waiting for the quiet period to elapse
+    std::set<TCanvas*> pendingResizes;
+    TTimer *resizeTimer;
+    Long_t resizeDelay;
+    Bool_t resizeImmediatePass;
+    Bool_t gridColumnAlignment;
+    void processCanvasMargins(TCanvas *canvas);
+
+    // Zero delay timer - runs work scheduled from within painting once painting is over
+    TTimer *afterPaintTimer;
+
+    // Lazily registered canvases painted for the first time, laid out by the after paint timer
+    Bool_t lazyRegistration;
+    std::set<TCanvas*> pendingFirstLayouts;
+    Bool_t runPendingLayout(TCanvas *canvas);
+    void processFirstLayouts();
+
+    // Live canvases with pads waiting for layout. Processed after painting with a bounded number of pads per iteration
+    std::set<TCanvas*> pendingLiveCanvases;
+    void checkLivePad(TCanvas *canvas, CanvasEntry &entry, TVirtualPad *pad);
+    void processLivePads();
+
+    // Refresh requests waiting for a scheduler tick. Value is the time of the first request in steady clock milliseconds
+    std::unordered_map<TCanvas*, Double_t> refreshQueue;
+    TTimer *refreshTimer;
+    Double_t refreshBudgetMs;
+    Long_t refreshPeriodMs;
+    Double_t refreshMaxLatencyMs;
+    RefreshStats refreshStats;
+    Double_t refreshLatencySumMs;
+    Double_t refreshTickSumMs;
+    void processRefreshQueue();
+    void refreshCanvas(TCanvas *canvas);
+
+    // Display-only copies of large objects swapped into pad lists in place of the originals. Keyed by display object
+    struct DisplaySwap {
+        TCanvas *canvas;
+        TVirtualPad *pad;
+        TList *list;                // pad primitives or list of graphs of a TMultiGraph
+        TObject *original;
+        ULong64_t key;              // pad range and original data the display was computed for
+        Bool_t inPrimitives;
+        Bool_t ownsOriginal;        // original was owned by the list - deleted together with the display
+    };
+    // Pads with display objects and the range their displays were computed for
+    struct DisplayPad {
+        TCanvas *canvas;
+        ULong64_t rangeKey;
+    };
+    std::unordered_map<TObject*, DisplaySwap> displaySwaps;
+    std::unordered_map<TObject*, TObject*> displayOfOriginal;
+    std::unordered_map<TVirtualPad*, DisplayPad> displayPads;
 
-    std::map<TCanvas*, std::pair<unsigned int, unsigned int>> registeredCanvases;
+    // Pixel grid of the pad frame and visible axis ranges in pad coordinates (decades for logarithmic axes)
+    struct DisplayRange {
+        Int_t columns;
+        Int_t rows;
+        Double_t xMin;
+        Double_t xMax;
+        Double_t yMin;
+        Double_t yMax;
+        Bool_t logX;
+        Bool_t logY;
+    };
+    UInt_t updateDisplayObjects(TCanvas *canvas, const PadIndex &padIndex, Bool_t graphs, Bool_t histograms);
+    void restoreDisplayObject(TObject *display);
+    UInt_t restoreDisplayObjects(TCanvas *canvas);
+    void forgetDisplayObject(TObject *object);
+    std::vector<TObject*> hideDisplayObjects(TCanvas *canvas);
+    void showDisplayObjects(const std::vector<TObject*> &displays);
+    static DisplayRange getDisplayRange(TVirtualPad *pad);
+    static ULong64_t getDisplayRangeKey(const DisplayRange &range);
+    static void hashGraphState(ULong64_t &hash, TGraph *graph);
+    static ULong64_t getDisplayKey(TObject *original, ULong64_t rangeKey);
+    void invalidateDisplayObjects(TCanvas *canvas);
+    static Bool_t isRebinnableHistogram(TObject *object);
+    static TObject* createDisplayObject(TObject *original, const DisplayRange &range);
+    static void moveDisplayState(TObject *from, TObject *to, Bool_t keepSource = kFALSE);
+    static TGraph* decimateGraph(TGraph *graph, const DisplayRange &range);
+    static Bool_t getDisplayBinGroups(TAxis *axis, Int_t pixels, Double_t min, Double_t max, Bool_t log, std::vector<Int_t> &starts);
+    static TH1* rebinHistogram(TH1 *histogram, const DisplayRange &range);
 //    std::map<std::string, double> defaultPadLeftMargins;
 //    static TGraph* findTGraphOnPad(TVirtualPad* pad);
 
@@ -260,49 +1050,87 @@ class CanvasHelper: public TObject {
 
     static void alignChildPad(TVirtualPad *pad);
 
-    static Int_t getFrameLeftMarginPx(TVirtualPad *pad);
-    static Int_t getFrameRightMarginPx(/*TVirtualPad* pad*/);
-    static Int_t getFrameTopMarginPx(TVirtualPad *pad);
-    static Int_t getFrameBottomMarginPx(TVirtualPad *pad);
-
-    static Bool_t hasXAxisTitle(TVirtualPad *pad);
-    static Bool_t hasYAxisTitle(TVirtualPad *pad);
+    static Bool_t hasXAxisTitle(const PadModel &model);
+    static Bool_t hasYAxisTitle(const PadModel &model);
 
     static Bool_t isChildPad(TVirtualPad *pad);
 
-    static void alignTitle(TVirtualPad *pad);
-    static void alignSubtitle(TVirtualPad *pad);
-    static void alignSubtitle(TPaveText *subtitle, TVirtualPad *pad);
-    static void alignAllPaves(TVirtualPad *pad);
+    // Layout math lives in the Layout namespace. Functions below collect its input from pads and apply its output
+    typedef Layout::PadLayout PadLayout;
+    typedef Layout::PadGeometry PadGeometry;
+    static Layout::PadInput getLayoutInput(const PadModel &model, Bool_t measurePaves = kTRUE);
+    static PadLayout computePadLayout(const PadModel &model);
+
+    static void alignTitle(const PadModel &model, const PadGeometry &geometry);
+    static void alignSubtitle(const PadModel &model, const PadGeometry &geometry);
+    static UInt_t stylePaves(const PadModel &model);
+    static void alignColumnLabelWidths(std::vector<PadModel> &models, const PadIndex &padIndex);
+    static void applySharedAxes(std::vector<PadModel> &models, const PadIndex &padIndex, UInt_t sharedAxes);
+
+    static void alignAllPaves(const PadModel &model, const PadGeometry &geometry);
     // static void alignAxisTitles(TVirtualPad* pad);
 
-    void processCanvas(TCanvas *canvas);
-    void processPad(TVirtualPad *pad);
-    static void setPadMargins(TVirtualPad *pad);
+    // One canvas of a layout pass. Pads of all canvases of the pass are computed by a single Layout::computePads() call
+    struct CanvasPass {
+        TCanvas *canvas = nullptr;
+        std::vector<PadModel> models;                                 // changed pads, laid out in this order
+        std::vector<UInt_t> styleWrites;                              // attributes written by stylePaves() per model
+        size_t firstInput = 0;                                         // index of the first model in the pass inputs
+        std::unordered_map<TVirtualPad*, ULong64_t> fingerprints;     // fingerprints after the pass
+        UInt_t skippedPads = 0;
+        UInt_t layoutClasses = 0;
+        UInt_t displaysChanged = 0;
+        ULong64_t attributesWritten = 0;
+        Double_t elapsedMs = 0;
+    };
+    UInt_t processCanvas(TCanvas *canvas);
+    void runLayoutPasses(std::vector<CanvasPass> &passes);
+    void collectCanvasPass(CanvasPass &pass, std::vector<Layout::PadInput> &inputs);
+    void applyCanvasPass(CanvasPass &pass, const std::vector<PadGeometry> &geometries);
+    UInt_t processPad(const PadModel &model, const PadGeometry &geometry, UInt_t styleWrites = 0);
+    static ULong64_t getPadFingerprint(const PadModel &model);
+    static void hashPlotRange(ULong64_t &hash, TObject *plot);
+    static void setPadMargins(const PadModel &model, const PadLayout &layout);
 
-    static void setPadNDivisions(TVirtualPad *pad);
-    void convertAxisToPxSize(TAxis *axis, const char type, TVirtualPad *pad);
+    static void setPadNDivisions(const PadModel &model, const PadLayout &layout);
+    void convertAxisToPxSize(TAxis *axis, const char type, const PadModel &model, const PadLayout &layout);
 
-    static void setPadCustomFrameBorder(TVirtualPad *pad);
+    static void setPadCustomFrameBorder(const PadModel &model);
 
     static Double_t getPadWidthPx(TVirtualPad *pad);
     static Double_t getPadHeightPx(TVirtualPad *pad);
 
-    static std::pair<TAxis*, TAxis*> getPadXYAxis(TVirtualPad *pad);
-    static Double_t getYAxisMaxLabelWidthPx(TVirtualPad *pad);
+    static PadModel buildPadModel(TVirtualPad *pad);
+    static Double_t getYAxisMaxLabelWidthPx(TVirtualPad *pad, const CanvasTheme &theme);
 //    Double_t getLabelHeigthPx();
 
-    static Double_t pxToNdcHorizontal(Int_t px, TVirtualPad *pad);
-    static Double_t pxToNdcVertical(Int_t py, TVirtualPad *pad);
-
     static constexpr char subtitleObjectName[] = "subtitle";
 
     static TFrame* getPadFrame(TVirtualPad *pad);
 
+    static void warmUpExport(UInt_t format);
+    static std::vector<ExportResult> saveCanvasesForked(UInt_t nCanvases, std::function<TCanvas*(UInt_t)> getCanvas, Bool_t ownsCanvases,
+                                                        UInt_t format, UInt_t nWorkers, std::function<void(const ExportResult&)> callback);
+
   public:
     // Slot for canvas resizing (need to be public)
     void onCanvasResized();
 
+    // Slot for canvas closing (need to be public)
+    void onCanvasClosed();
+
+    // Slot for pad axis range changes, e.g. zoom (need to be public)
+    void onPadRangeChanged();
+
+    // Slot for user events on canvas - used to prioritize refreshes (need to be public)
+    void onCanvasEvent(Int_t event, Int_t px, Int_t py, TObject *selected);
+
+    // Called via gROOT list of cleanups when any object is deleted
+    virtual void RecursiveRemove(TObject *object);
+
+    // Fired once resize signals settle down
+    virtual Bool_t HandleTimer(TTimer *timer);
+
   ClassDef(CanvasHelper, 0)
 };
 